@@ -86,6 +86,8 @@ in {
           certificate.file = cfg.influxdb.certificateFile;
         };
         inherit (cfg) address;
+        history_state = "/var/lib/water-level/history";
+        gatt_cache = "/var/lib/water-level/gatt";
       });
     in {
       wantedBy = [ "multi-user.target" ];
@@ -93,6 +95,7 @@ in {
       serviceConfig = {
         User = "water-level";
         Group = "water-level";
+        StateDirectory = "water-level";
         Restart = "always";
         RestartSec = 10;
         ExecStart = escapeShellArgs [
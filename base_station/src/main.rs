@@ -1,11 +1,12 @@
 use std::fs::File;
+use std::path::{Path, PathBuf};
 use std::time::{Duration, SystemTime};
 
 use anyhow::Context;
 use serde::Deserialize;
 
 use crate::influxdb::{TimestampPrecision, Value};
-use crate::sensor::Sensor;
+use crate::sensor::{GattCache, HistoryCursor, Sensor};
 
 mod influxdb;
 mod sensor;
@@ -14,6 +15,10 @@ const fn default_new_data_timeout() -> u32 {
     16 * 60 * 1000
 }
 
+/// Time to wait for new data beyond the update period reported by the
+/// sensor
+const NEW_DATA_MARGIN: Duration = Duration::from_secs(60);
+
 #[derive(Deserialize, Debug)]
 struct CertificateConfig {
     file: String,
@@ -28,43 +33,257 @@ struct InfluxDbConfig {
     certificate: CertificateConfig,
 }
 
+/// Bounds of the sensor update period, in seconds
+#[derive(Deserialize, Debug)]
+struct PeriodConfig {
+    min: u32,
+    max: u32,
+}
+
+/// Water level alert thresholds, in meters
+#[derive(Deserialize, Debug)]
+struct ThresholdsConfig {
+    #[serde(default)]
+    high: f32,
+    #[serde(default)]
+    low: f32,
+    #[serde(default)]
+    hysteresis: f32,
+}
+
+/// Sensor sampling policy
+#[derive(Deserialize, Debug)]
+struct SamplingConfig {
+    /// Distance samples per measurement
+    samples: u8,
+    /// Maximum number of rangefinder pings per measurement
+    max_attempts: u8,
+    /// Largest accepted distance as a percentage of the tank depth
+    range: u16,
+}
+
 #[derive(Deserialize, Debug)]
 struct Config {
     influxdb: InfluxDbConfig,
     address: bluer::Address,
+    /// Time to wait for new data until the sensor has reported its update
+    /// period
     #[serde(default = "default_new_data_timeout")]
     new_data_timeout: u32,
+    /// Update period bounds to configure on the sensor
+    #[serde(default)]
+    period: Option<PeriodConfig>,
+    /// Water level alert thresholds to configure on the sensor
+    #[serde(default)]
+    thresholds: Option<ThresholdsConfig>,
+    /// Sampling policy to configure on the sensor
+    #[serde(default)]
+    sampling: Option<SamplingConfig>,
+    /// File used to remember which history records have been downloaded
+    /// across restarts
+    #[serde(default)]
+    history_state: Option<PathBuf>,
+    /// Collect measurements from the sensor broadcasts when possible instead
+    /// of connecting. Only connects when broadcasts were missed, to download
+    /// the history and sync the configuration.
+    #[serde(default)]
+    broadcast: bool,
+    /// File used to remember where the sensor characteristics are, so they
+    /// only have to be discovered again when the sensor firmware changes
+    #[serde(default)]
+    gatt_cache: Option<PathBuf>,
+    /// Stay connected to the sensor and receive new data as notifications,
+    /// instead of waiting for it to advertise and connecting every time
+    #[serde(default)]
+    notify: bool,
 }
 
-async fn wait_new_data(
-    sensor: &mut sensor::Sensor,
-    adapter: &bluer::Adapter,
-) -> anyhow::Result<SystemTime> {
-    log::debug!("waiting for new data...");
-    sensor.wait_new_data(adapter).await?;
-    // Get timestamp as close as possible to when the data was collected
-    Ok(SystemTime::now())
+/// Parse the history state, a sequence number followed by the epoch it belongs
+/// to.
+fn parse_history_cursor(s: &str) -> Option<HistoryCursor> {
+    let (seq, epoch) = s.trim().split_once(' ')?;
+    Some(HistoryCursor {
+        seq: seq.parse().ok()?,
+        epoch: Some(epoch.parse().ok()?),
+    })
 }
 
-async fn read_data(
-    sensor: &mut sensor::Sensor,
-    timestamp: SystemTime,
-) -> anyhow::Result<influxdb::Point> {
-    log::debug!("connecting...");
-    match sensor.connect().await {
-        Err(sensor::Error::BlueZ(bluer::Error {
-            kind: bluer::ErrorKind::AlreadyConnected,
-            ..
-        })) => log::warn!("already connected to sensor"),
-        r => r?,
+fn load_history_cursor(path: &Path) -> HistoryCursor {
+    match std::fs::read_to_string(path) {
+        Ok(s) => parse_history_cursor(&s).unwrap_or_else(|| {
+            log::warn!("invalid history state: {:?}", s);
+            HistoryCursor::default()
+        }),
+        Err(e) => {
+            log::info!("no history state loaded: {}", e);
+            HistoryCursor::default()
+        }
+    }
+}
+
+fn save_history_cursor(path: &Path, cursor: HistoryCursor) {
+    // Nothing was downloaded yet
+    let Some(epoch) = cursor.epoch else {
+        return;
     };
+    if let Err(e) = std::fs::write(path, format!("{} {}\n", cursor.seq, epoch)) {
+        log::warn!("failed to save history state: {}", e);
+    }
+}
+
+fn load_gatt_cache(path: &Path) -> Option<GattCache> {
+    match std::fs::read_to_string(path) {
+        Ok(s) => serde_yaml::from_str(&s)
+            .inspect_err(|e| log::warn!("invalid GATT cache: {}", e))
+            .ok(),
+        Err(e) => {
+            log::info!("no GATT cache loaded: {}", e);
+            None
+        }
+    }
+}
+
+fn save_gatt_cache(path: &Path, cache: &GattCache) {
+    let result = serde_yaml::to_string(cache)
+        .map_err(anyhow::Error::from)
+        .and_then(|s| Ok(std::fs::write(path, s)?));
+    if let Err(e) = result {
+        log::warn!("failed to save GATT cache: {}", e);
+    }
+}
+
+fn history_point(record: &sensor::HistoryRecord) -> influxdb::Point {
+    let mut point = influxdb::Point::new("water_tank_history".into());
+    point.set_timestamp(influxdb::Timestamp::new(
+        record.timestamp,
+        TimestampPrecision::Second,
+    ));
+    point.add_field(
+        "water_level".into(),
+        Value::Float(record.water_level as f64),
+    );
+    point.add_field(
+        "water_distance".into(),
+        Value::Float(record.water_distance as f64),
+    );
+    point.add_field(
+        "temperature".into(),
+        Value::Float(record.temperature as f64),
+    );
+    point.add_field(
+        "battery_voltage".into(),
+        Value::Float(record.battery_voltage as f64),
+    );
+    point
+}
 
+fn broadcast_point(broadcast: &sensor::Broadcast, timestamp: SystemTime) -> influxdb::Point {
     let mut point = influxdb::Point::new("water_tank".into());
     point.set_timestamp(influxdb::Timestamp::new(
         timestamp,
         TimestampPrecision::Second,
     ));
+    point.add_field(
+        "alert".into(),
+        Value::Boolean(broadcast.status & Sensor::STATUS_ALERT != 0),
+    );
+    point.add_field(
+        "leak".into(),
+        Value::Boolean(broadcast.status & Sensor::STATUS_LEAK != 0),
+    );
+    point.add_field(
+        "low_power".into(),
+        Value::Boolean(broadcast.status & Sensor::STATUS_LOW_POWER != 0),
+    );
+    point.add_field(
+        "battery_percentage".into(),
+        Value::Integer(broadcast.battery_percentage as i64),
+    );
+    point.add_field(
+        "battery_voltage".into(),
+        Value::Float(broadcast.battery_voltage as f64),
+    );
+    point.add_field(
+        "temperature".into(),
+        Value::Float(broadcast.temperature as f64),
+    );
+    point.add_field(
+        "water_level".into(),
+        Value::Float(broadcast.water_level as f64),
+    );
+    point.add_field(
+        "water_distance".into(),
+        Value::Float(broadcast.water_distance as f64),
+    );
+    point.add_field("errors".into(), Value::Integer(broadcast.errors as i64));
+    point
+}
 
+async fn wait_new_data(
+    sensor: &mut sensor::Sensor,
+    adapter: &bluer::Adapter,
+    last_broadcast_seq: Option<u16>,
+) -> anyhow::Result<(SystemTime, u32, Option<sensor::Broadcast>)> {
+    log::debug!("waiting for new data...");
+    let (status, broadcast) = sensor.wait_new_data(adapter, last_broadcast_seq).await?;
+    // Get timestamp as close as possible to when the data was collected
+    Ok((SystemTime::now(), status, broadcast))
+}
+
+/// Add the fields read from a snapshot. The alert field is only added if
+/// `add_alert` is set, since it normally comes from the advertised status.
+fn add_snapshot_fields(point: &mut influxdb::Point, snapshot: &sensor::Snapshot, add_alert: bool) {
+    if add_alert {
+        point.add_field(
+            "alert".into(),
+            Value::Boolean(snapshot.status & Sensor::STATUS_ALERT != 0),
+        );
+    }
+    point.add_field(
+        "battery_percentage".into(),
+        Value::Integer(snapshot.battery_percentage as i64),
+    );
+    point.add_field(
+        "battery_voltage".into(),
+        Value::Float(snapshot.battery_voltage as f64),
+    );
+    point.add_field(
+        "temperature".into(),
+        Value::Float(snapshot.temperature as f64),
+    );
+    point.add_field(
+        "water_level".into(),
+        Value::Float(snapshot.water_level as f64),
+    );
+    point.add_field(
+        "water_distance".into(),
+        Value::Float(snapshot.water_distance as f64),
+    );
+    point.add_field(
+        "tank_depth".into(),
+        Value::Float(snapshot.tank_depth as f64),
+    );
+    point.add_field("pings".into(), Value::Integer(snapshot.pings as i64));
+    point.add_field("samples".into(), Value::Integer(snapshot.samples as i64));
+    point.add_field("flow_rate".into(), Value::Float(snapshot.flow_rate as f64));
+    point.add_field(
+        "leak".into(),
+        Value::Boolean(snapshot.status & Sensor::STATUS_LEAK != 0),
+    );
+    point.add_field(
+        "low_power".into(),
+        Value::Boolean(snapshot.status & Sensor::STATUS_LOW_POWER != 0),
+    );
+    point.add_field("errors".into(), Value::Integer(snapshot.errors as i64));
+    point.add_field(
+        "period".into(),
+        Value::Integer(snapshot.period.as_secs() as i64),
+    );
+}
+
+/// Read the values one at a time, for sensors without the snapshot
+/// characteristic.
+async fn read_values(sensor: &sensor::Sensor, point: &mut influxdb::Point) {
     log::debug!("reading battery percentage...");
     match sensor.battery_percentage().await {
         Ok(battery_percentage) => point.add_field(
@@ -109,37 +328,465 @@ async fn read_data(
         Err(e) => log::warn!("failed to read tank depth: {}", e),
     }
 
+    log::debug!("reading sample counts...");
+    match sensor.samples().await {
+        Ok(Some((pings, samples))) => {
+            point.add_field("pings".into(), Value::Integer(pings as i64));
+            point.add_field("samples".into(), Value::Integer(samples as i64));
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read sample counts: {}", e),
+    }
+
+    log::debug!("reading flow rate...");
+    match sensor.flow_rate().await {
+        Ok(Some(flow_rate)) => point.add_field("flow_rate".into(), Value::Float(flow_rate as f64)),
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read flow rate: {}", e),
+    }
+
+    log::debug!("reading leak state...");
+    match sensor.leak().await {
+        Ok(Some(leak)) => point.add_field("leak".into(), Value::Boolean(leak)),
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read leak state: {}", e),
+    }
+
     log::debug!("reading errors...");
     match sensor.errors().await {
         Ok(errors) => point.add_field("errors".into(), Value::Integer(errors as i64)),
         Err(e) => log::warn!("failed to read errors: {}", e),
     }
+}
+
+async fn read_data(
+    sensor: &mut sensor::Sensor,
+    timestamp: SystemTime,
+    status: Option<u32>,
+    config: &Config,
+    history_cursor: &mut HistoryCursor,
+    period: &mut Option<Duration>,
+) -> anyhow::Result<Vec<influxdb::Point>> {
+    log::debug!("connecting...");
+    match sensor.connect().await {
+        Err(sensor::Error::BlueZ(bluer::Error {
+            kind: bluer::ErrorKind::AlreadyConnected,
+            ..
+        })) => log::warn!("already connected to sensor"),
+        r => r?,
+    };
+    if let (Some(path), Some(cache)) = (&config.gatt_cache, sensor.take_updated_gatt_cache()) {
+        save_gatt_cache(path, cache);
+    }
+
+    let mut point = influxdb::Point::new("water_tank".into());
+    point.set_timestamp(influxdb::Timestamp::new(
+        timestamp,
+        TimestampPrecision::Second,
+    ));
+
+    if let Some(status) = status {
+        point.add_field(
+            "alert".into(),
+            Value::Boolean(status & Sensor::STATUS_ALERT != 0),
+        );
+    }
+
+    log::debug!("reading snapshot...");
+    let snapshot = match sensor.snapshot().await {
+        Ok(snapshot) => snapshot,
+        Err(e) => {
+            log::warn!("failed to read snapshot: {}", e);
+            None
+        }
+    };
+
+    match &snapshot {
+        Some(snapshot) => {
+            add_snapshot_fields(&mut point, snapshot, status.is_none());
+            *period = Some(snapshot.period);
+        }
+        None => read_values(sensor, &mut point).await,
+    }
+
+    log::debug!("reading advertising statistics...");
+    match sensor.advertising_stats().await {
+        Ok(Some(stats)) => {
+            point.add_field(
+                "adv_duration".into(),
+                Value::Float(stats.last_duration.as_secs_f64()),
+            );
+            point.add_field(
+                "adv_events".into(),
+                Value::Integer(stats.last_events as i64),
+            );
+            point.add_field("adv_timeouts".into(), Value::Integer(stats.timeouts as i64));
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read advertising statistics: {}", e),
+    }
+
+    log::debug!("reading connection statistics...");
+    match sensor.connection_stats().await {
+        Ok(Some(stats)) => {
+            log::debug!("connection statistics: {:?}", stats);
+            // Durations are from the previous connection, which has ended
+            point.add_field(
+                "conn_duration".into(),
+                Value::Float(stats.last_duration.as_secs_f64()),
+            );
+            if let Some(sync) = stats.last_sync {
+                point.add_field("sync_duration".into(), Value::Float(sync.as_secs_f64()));
+            }
+            point.add_field(
+                "conn_interval".into(),
+                Value::Float(stats.interval.as_secs_f64() * 1000.0),
+            );
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read connection statistics: {}", e),
+    }
+
+    log::debug!("reading energy counters...");
+    match sensor.energy().await {
+        Ok(Some(energy)) => {
+            log::debug!("energy counters: {:?}", energy);
+            for (name, charge) in [
+                ("energy_rangefinder", energy.rangefinder_charge),
+                ("energy_adc", energy.adc_charge),
+                ("energy_radio", energy.radio_charge),
+                ("energy_cpu", energy.cpu_charge),
+            ] {
+                point.add_field(name.into(), Value::Float(charge as f64));
+            }
+            point.add_field(
+                "cpu_active_time".into(),
+                Value::Integer(energy.cpu_active_time.as_secs() as i64),
+            );
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read energy counters: {}", e),
+    }
+
+    log::debug!("reading update timing...");
+    match sensor.update_timing().await {
+        Ok(Some(timing)) => {
+            log::debug!("update timing: {:?}", timing);
+            point.add_field(
+                "update_duration".into(),
+                Value::Float(timing.total.as_secs_f64()),
+            );
+            point.add_field(
+                "water_level_duration".into(),
+                Value::Float(timing.water_level.as_secs_f64()),
+            );
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read update timing: {}", e),
+    }
+
+    log::debug!("reading crash record...");
+    match sensor.crash_record().await {
+        Ok(Some(record)) => {
+            point.add_field("resets".into(), Value::Integer(record.resets as i64));
+            if let Some(crash) = record.last {
+                log::warn!(
+                    "sensor crashed {} time(s), last: {:?}",
+                    record.crashes,
+                    crash
+                );
+                point.add_field("crashes".into(), Value::Integer(record.crashes as i64));
+                point.add_field("crash_reason".into(), Value::Integer(crash.reason as i64));
+                point.add_field(
+                    "crash_pc".into(),
+                    Value::String(format!("{:#010x}", crash.pc)),
+                );
+                point.add_field(
+                    "crash_lr".into(),
+                    Value::String(format!("{:#010x}", crash.lr)),
+                );
+                point.add_field(
+                    "crash_uptime".into(),
+                    Value::Float(crash.uptime.as_secs_f64()),
+                );
+                point.add_field("crash_thread".into(), Value::String(crash.thread));
+                // Each crash is only recorded once
+                if let Err(e) = sensor.clear_crash_record().await {
+                    log::warn!("failed to clear crash record: {}", e);
+                }
+            }
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read crash record: {}", e),
+    }
+
+    log::debug!("reading watchdog report...");
+    match sensor.watchdog_report().await {
+        Ok(Some(report)) => {
+            log::debug!("watchdog report: {:?}", report);
+            point.add_field("wdt_resets".into(), Value::Integer(report.resets as i64));
+            if let Some(hung) = report.hung {
+                point.add_field("wdt_hung".into(), Value::String(hung.into()));
+            }
+            for task in report.tasks {
+                point.add_field(
+                    format!("wdt_{}_worst", task.name),
+                    Value::Float(task.worst.as_secs_f64()),
+                );
+                point.add_field(
+                    format!("wdt_{}_overruns", task.name),
+                    Value::Integer(task.overruns as i64),
+                );
+                if let Some(overrun) = task.last_overrun {
+                    point.add_field(
+                        format!("wdt_{}_last_overrun", task.name),
+                        Value::Float(overrun.as_secs_f64()),
+                    );
+                }
+            }
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read watchdog report: {}", e),
+    }
+
+    // The snapshot holds the period, but not the bounds needed to check the
+    // configuration
+    if snapshot.is_none() || config.period.is_some() {
+        log::debug!("reading period...");
+        match sensor.period().await {
+            Ok(Some((p, min, max))) => {
+                if snapshot.is_none() {
+                    point.add_field("period".into(), Value::Integer(p.as_secs() as i64));
+                }
+                *period = Some(p);
+
+                // Only write the bounds when they change, since the sensor
+                // stores them in flash
+                if let Some(config) = &config.period {
+                    let (new_min, new_max) = (
+                        Duration::from_secs(config.min as u64),
+                        Duration::from_secs(config.max as u64),
+                    );
+                    if (new_min, new_max) != (min, max) {
+                        log::info!("setting period bounds to {:?}-{:?}", new_min, new_max);
+                        if let Err(e) = sensor.set_period_bounds(new_min, new_max).await {
+                            log::warn!("failed to set period bounds: {}", e);
+                        }
+                    }
+                }
+            }
+            Ok(None) if config.period.is_some() => {
+                log::warn!("sensor does not support setting the period bounds")
+            }
+            Ok(None) => {}
+            Err(e) => log::warn!("failed to read period: {}", e),
+        }
+    }
+    if let Some(config) = &config.thresholds {
+        log::debug!("reading thresholds...");
+        match sensor.thresholds().await {
+            Ok(Some(current)) => {
+                // Compare in millimeters, which is what the sensor stores
+                let mm = |v: f32| (v * 1000.0).round() as u16;
+                let (high, low, hysteresis) = current;
+                if (mm(high), mm(low), mm(hysteresis))
+                    != (mm(config.high), mm(config.low), mm(config.hysteresis))
+                {
+                    log::info!("setting thresholds to {:?}", config);
+                    if let Err(e) = sensor
+                        .set_thresholds(config.high, config.low, config.hysteresis)
+                        .await
+                    {
+                        log::warn!("failed to set thresholds: {}", e);
+                    }
+                }
+            }
+            Ok(None) => log::warn!("sensor does not support thresholds"),
+            Err(e) => log::warn!("failed to read thresholds: {}", e),
+        }
+    }
+    if let Some(config) = &config.sampling {
+        log::debug!("reading configuration...");
+        match sensor.config().await {
+            Ok(Some(current)) => {
+                // Keeps the period bounds, which are configured above
+                let new = sensor::SensorConfig {
+                    samples: config.samples,
+                    max_attempts: config.max_attempts,
+                    range: config.range,
+                    ..current.clone()
+                };
+                if new != current {
+                    log::info!("setting sampling policy to {:?}", config);
+                    if let Err(e) = sensor.set_config(&new).await {
+                        log::warn!("failed to set sampling policy: {}", e);
+                    }
+                }
+            }
+            Ok(None) => log::warn!("sensor does not support setting the sampling policy"),
+            Err(e) => log::warn!("failed to read configuration: {}", e),
+        }
+    }
+
+    let mut points = vec![point];
+
+    log::debug!("reading history since {}...", history_cursor.seq);
+    match sensor.history(*history_cursor).await {
+        Ok(Some((records, next))) => {
+            log::debug!("read {} history records", records.len());
+            points.extend(records.iter().map(history_point));
+            *history_cursor = next;
+        }
+        Ok(None) => {}
+        Err(e) => log::warn!("failed to read history: {}", e),
+    }
 
     log::debug!("clearing status...");
     if let Err(e) = sensor.clear_new_data().await {
         log::warn!("failed to clear new data status: {}", e);
     }
 
+    Ok(points)
+}
+
+async fn collect_data(
+    sensor: &mut sensor::Sensor,
+    adapter: &bluer::Adapter,
+    new_data_timeout: Duration,
+    config: &Config,
+    history_cursor: &mut HistoryCursor,
+    period: &mut Option<Duration>,
+    broadcast_seq: &mut Option<u16>,
+) -> anyhow::Result<Vec<influxdb::Point>> {
+    let (timestamp, status, broadcast) = match tokio::time::timeout(
+        new_data_timeout,
+        wait_new_data(sensor, adapter, *broadcast_seq),
+    )
+    .await
+    {
+        Ok(r) => r.map(|(t, s, b)| (t, Some(s), b)),
+        Err(_) => {
+            log::warn!("timed out waiting for new data");
+            Ok((SystemTime::now(), None, None))
+        }
+    }?;
+
+    if let (true, Some(b)) = (config.broadcast, &broadcast) {
+        match *broadcast_seq {
+            Some(last) if b.seq == last.wrapping_add(1) => {
+                *broadcast_seq = Some(b.seq);
+                return Ok(vec![broadcast_point(b, timestamp)]);
+            }
+            Some(last) => log::info!(
+                "missed {} broadcasts, connecting to download history",
+                b.seq.wrapping_sub(last).wrapping_sub(1)
+            ),
+            None => log::info!("first broadcast, connecting to sync sensor"),
+        }
+    }
+
+    let points = read_data(sensor, timestamp, status, config, history_cursor, period).await?;
+    if let Some(b) = broadcast {
+        *broadcast_seq = Some(b.seq);
+    }
+
     log::debug!("disconnecting...");
     sensor.disconnect().await?;
 
-    Ok(point)
+    Ok(points)
 }
 
-async fn collect_data(
+/// Write points to InfluxDB, and remember the downloaded history once all of
+/// them have been stored.
+fn write_points(
+    influxdb: &influxdb::Client,
+    points: &[influxdb::Point],
+    config: &Config,
+    history_cursor: &mut HistoryCursor,
+    next_history_cursor: HistoryCursor,
+) {
+    let mut written = true;
+    for point in points {
+        log::debug!("writing point: {}", point);
+        if let Err(e) = influxdb.write_point(point) {
+            log::error!("failed to write data to InfluxDB: {}", e);
+            written = false;
+        }
+    }
+    // Download the history again next time if it wasn't stored
+    if written && next_history_cursor != *history_cursor {
+        *history_cursor = next_history_cursor;
+        if let Some(path) = &config.history_state {
+            save_history_cursor(path, *history_cursor);
+        }
+    }
+}
+
+/// Connect when the sensor has new data, then stay connected and write every
+/// snapshot it notifies. Returns when the connection is lost.
+async fn stream_data(
     sensor: &mut sensor::Sensor,
     adapter: &bluer::Adapter,
-    new_data_timeout: Duration,
-) -> anyhow::Result<influxdb::Point> {
-    let timestamp =
-        match tokio::time::timeout(new_data_timeout, wait_new_data(sensor, adapter)).await {
-            Ok(t) => t,
+    influxdb: &influxdb::Client,
+    config: &Config,
+    history_cursor: &mut HistoryCursor,
+    period: &mut Option<Duration>,
+) -> anyhow::Result<()> {
+    // The sensor only advertises, and can only be connected to, when it has
+    // new data
+    let (timestamp, status, _) = wait_new_data(sensor, adapter, None).await?;
+
+    // Catch up on anything missed while disconnected
+    let mut next_history_cursor = *history_cursor;
+    let points = read_data(
+        sensor,
+        timestamp,
+        Some(status),
+        config,
+        &mut next_history_cursor,
+        period,
+    )
+    .await?;
+    write_points(
+        influxdb,
+        &points,
+        config,
+        history_cursor,
+        next_history_cursor,
+    );
+
+    log::debug!("subscribing to snapshots...");
+    let mut snapshots = std::pin::pin!(sensor.snapshots().await?);
+    loop {
+        let timeout = period.map_or(Duration::from_millis(config.new_data_timeout as u64), |p| {
+            p + NEW_DATA_MARGIN
+        });
+        let snapshot = match tokio::time::timeout(timeout, snapshots.next()).await {
+            Ok(Some(snapshot)) => snapshot,
+            Ok(None) => {
+                log::warn!("sensor stopped sending snapshots");
+                break;
+            }
             Err(_) => {
-                log::warn!("timed out waiting for new data");
-                Ok(SystemTime::now())
+                log::warn!("timed out waiting for snapshot");
+                break;
             }
-        }?;
-    read_data(sensor, timestamp).await
+        };
+
+        let mut point = influxdb::Point::new("water_tank".into());
+        point.set_timestamp(influxdb::Timestamp::new(
+            SystemTime::now(),
+            TimestampPrecision::Second,
+        ));
+        add_snapshot_fields(&mut point, &snapshot, true);
+        *period = Some(snapshot.period);
+        write_points(influxdb, &[point], config, history_cursor, *history_cursor);
+    }
+
+    log::debug!("disconnecting...");
+    sensor.disconnect().await?;
+
+    Ok(())
 }
 
 #[tokio::main(flavor = "current_thread")]
@@ -170,12 +817,15 @@ async fn main() -> anyhow::Result<()> {
         serde_yaml::from_reader(config_file).context("could not parse config file")?;
 
     let influxdb_cert = isahc::config::ClientCertificate::pkcs12_file(
-        config.influxdb.certificate.file,
-        Some(config.influxdb.certificate.password),
+        config.influxdb.certificate.file.clone(),
+        Some(config.influxdb.certificate.password.clone()),
     );
 
-    let influxdb =
-        influxdb::Client::new(config.influxdb.url, config.influxdb.database, influxdb_cert)?;
+    let influxdb = influxdb::Client::new(
+        config.influxdb.url.clone(),
+        config.influxdb.database.clone(),
+        influxdb_cert,
+    )?;
 
     let session = bluer::Session::new().await?;
     let adapter = session
@@ -190,20 +840,61 @@ async fn main() -> anyhow::Result<()> {
         sensor.address()
     );
 
+    if let Some(cache) = config.gatt_cache.as_deref().and_then(load_gatt_cache) {
+        sensor.set_gatt_cache(cache);
+    }
+
+    let mut history_cursor = config
+        .history_state
+        .as_deref()
+        .map(load_history_cursor)
+        .unwrap_or_default();
+
+    // Update period last reported by the sensor
+    let mut period = None;
+    // Sequence number of the last broadcast that was collected
+    let mut broadcast_seq = None;
+
     loop {
+        if config.notify {
+            if let Err(e) = stream_data(
+                &mut sensor,
+                &adapter,
+                &influxdb,
+                &config,
+                &mut history_cursor,
+                &mut period,
+            )
+            .await
+            {
+                log::error!("failed to stream data: {}", e);
+            }
+            continue;
+        }
+
+        let new_data_timeout = period
+            .map_or(Duration::from_millis(config.new_data_timeout as u64), |p| {
+                p + NEW_DATA_MARGIN
+            });
+        let mut next_history_cursor = history_cursor;
         match collect_data(
             &mut sensor,
             &adapter,
-            Duration::from_millis(config.new_data_timeout as u64),
+            new_data_timeout,
+            &config,
+            &mut next_history_cursor,
+            &mut period,
+            &mut broadcast_seq,
         )
         .await
         {
-            Ok(point) => {
-                log::debug!("writing point: {}", point);
-                if let Err(e) = influxdb.write_point(&point) {
-                    log::error!("failed to write data to InfluxDB: {}", e);
-                }
-            }
+            Ok(points) => write_points(
+                &influxdb,
+                &points,
+                &config,
+                &mut history_cursor,
+                next_history_cursor,
+            ),
             Err(e) => log::error!("failed to collect data: {}", e),
         };
     }
@@ -1,10 +1,13 @@
 use std::borrow::Cow;
+use std::collections::HashMap;
 use std::io;
-use std::io::Cursor;
+use std::io::{Cursor, Read};
+use std::time::{Duration, SystemTime};
 
 use bluer::Address;
 use byteorder::{LittleEndian, ReadBytesExt};
-use futures::StreamExt;
+use futures::{Stream, StreamExt};
+use serde::{Deserialize, Serialize};
 use thiserror::Error;
 use uuid::{uuid, Uuid};
 
@@ -26,6 +29,267 @@ pub enum Error {
     BlueZ(#[from] bluer::Error),
 }
 
+/// A measurement downloaded from the history stored on the sensor.
+#[derive(Debug, Clone)]
+pub struct HistoryRecord {
+    pub timestamp: SystemTime,
+    pub water_level: f32,
+    pub water_distance: f32,
+    pub temperature: f32,
+    pub battery_voltage: f32,
+}
+
+/// Position in the history stored on the sensor, used to only download
+/// records that are new since the last download.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct HistoryCursor {
+    /// Sequence number of the next record to download
+    pub seq: u32,
+    /// Random value identifying the sequence numbering `seq` belongs to, which
+    /// changes when the sensor loses its history and restarts from 0. `None`
+    /// if not known yet.
+    pub epoch: Option<u32>,
+}
+
+/// Status and measurements broadcast by the sensor in its advertising data,
+/// available without connecting.
+#[derive(Debug, Clone)]
+pub struct Broadcast {
+    /// Status bits
+    pub status: u32,
+    /// Incremented by the sensor for every measurement
+    pub seq: u16,
+    pub water_level: f32,
+    pub water_distance: f32,
+    pub temperature: f32,
+    pub battery_percentage: u8,
+    pub battery_voltage: f32,
+    /// Low 16 error bits
+    pub errors: u32,
+}
+
+/// All current values of the sensor, read at once.
+#[derive(Debug, Clone)]
+pub struct Snapshot {
+    pub status: u32,
+    pub errors: u32,
+    pub battery_percentage: u8,
+    pub battery_voltage: f32,
+    pub temperature: f32,
+    pub water_level: f32,
+    pub water_distance: f32,
+    pub tank_depth: f32,
+    pub pings: u8,
+    pub samples: u8,
+    /// Meters per hour
+    pub flow_rate: f32,
+    pub period: Duration,
+}
+
+/// Runtime configuration of the sensor.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct SensorConfig {
+    /// Distance samples per measurement
+    pub samples: u8,
+    /// Maximum number of rangefinder pings per measurement
+    pub max_attempts: u8,
+    /// Largest accepted distance as a percentage of the tank depth
+    pub range: u16,
+    pub period_min: Duration,
+    pub period_max: Duration,
+}
+
+/// Advertising statistics of the sensor. A cycle is the time the sensor
+/// advertises after a measurement, until a client connects or it gives up.
+#[derive(Debug, Clone)]
+pub struct AdvertisingStats {
+    pub cycles: u32,
+    /// Cycles that ended without a client connecting
+    pub timeouts: u32,
+    pub last_duration: Duration,
+    pub last_events: u32,
+    pub total_duration: Duration,
+    pub total_events: u32,
+}
+
+/// Connection statistics of the sensor. The durations are those of the last
+/// connection that ended, while the parameters were negotiated last, usually
+/// on the current connection.
+#[derive(Debug, Clone)]
+pub struct ConnectionStats {
+    pub connections: u32,
+    /// Time from connecting until the client collected the data, or `None` if
+    /// it did not
+    pub last_sync: Option<Duration>,
+    pub last_duration: Duration,
+    pub total_duration: Duration,
+    pub interval: Duration,
+    pub latency: u16,
+    pub timeout: Duration,
+}
+
+/// Energy counters of the sensor since its last power-on reset, and the
+/// charge drawn by each subsystem estimated from them.
+#[derive(Debug, Clone)]
+pub struct EnergyReport {
+    /// Time the rangefinder supply was switched on
+    pub rangefinder_time: Duration,
+    pub advertising_time: Duration,
+    /// Summed over all connections
+    pub connected_time: Duration,
+    pub cpu_active_time: Duration,
+    pub cpu_idle_time: Duration,
+    pub pings: u32,
+    pub adc_samples: u32,
+    pub adv_events: u32,
+    /// Estimated charge in mAh
+    pub rangefinder_charge: f32,
+    pub adc_charge: f32,
+    pub radio_charge: f32,
+    pub cpu_charge: f32,
+}
+
+/// Durations of the last update of the sensor, by stage.
+#[derive(Debug, Clone)]
+pub struct UpdateTiming {
+    /// Battery at rest and rangefinder power on
+    pub battery: Duration,
+    /// Temperature and battery under load, while the rangefinder warms up
+    pub sensors: Duration,
+    pub water_level: Duration,
+    pub publish: Duration,
+    /// From the start of the update until it was published
+    pub total: Duration,
+}
+
+/// Last fatal error of the sensor, kept across warm resets.
+#[derive(Debug, Clone)]
+pub struct CrashRecord {
+    /// Warm resets since the last power-on reset
+    pub resets: u16,
+    /// Fatal errors since the record was last cleared
+    pub crashes: u16,
+    /// Details of the last fatal error, if there was one
+    pub last: Option<Crash>,
+}
+
+#[derive(Debug, Clone)]
+pub struct Crash {
+    /// Zephyr `K_ERR_*` reason
+    pub reason: u32,
+    pub pc: u32,
+    pub lr: u32,
+    /// Time since boot
+    pub uptime: Duration,
+    pub thread: String,
+}
+
+/// Durations of a task supervised by the sensor watchdog.
+#[derive(Debug, Clone)]
+pub struct WatchdogTask {
+    pub name: &'static str,
+    /// Longest run
+    pub worst: Duration,
+    /// Duration of the last run that missed its deadline, if any
+    pub last_overrun: Option<Duration>,
+    /// Runs that missed their deadline
+    pub overruns: u16,
+}
+
+/// Task durations tracked by the sensor watchdog since its last power-on
+/// reset.
+#[derive(Debug, Clone)]
+pub struct WatchdogReport {
+    /// Resets caused by the watchdog
+    pub resets: u16,
+    /// Task that hung before the last watchdog reset
+    pub hung: Option<&'static str>,
+    pub tasks: Vec<WatchdogTask>,
+}
+
+/// Decoder for the compact history encoding used by the sensor (see
+/// `codec.h` in the firmware). A stream starts with a key holding the first
+/// entry in full, and every following entry is encoded as varint differences
+/// from the one before it.
+#[derive(Debug, Default, Clone)]
+struct HistoryDecoder {
+    seq: u32,
+    time: i32,
+    // Time between the last entry and the one before it
+    interval: i32,
+    water_level: u16,
+    water_distance: u16,
+    temperature: i16,
+    voltage: u16,
+}
+
+impl HistoryDecoder {
+    fn read_varint(v: &mut Cursor<&[u8]>) -> Result<u32, io::Error> {
+        let mut value = 0u32;
+        for shift in (0..32).step_by(7) {
+            let byte = v.read_u8()?;
+            value |= ((byte & 0x7f) as u32) << shift;
+            if byte & 0x80 == 0 {
+                return Ok(value);
+            }
+        }
+        Err(io::ErrorKind::InvalidData.into())
+    }
+
+    fn read_zigzag(v: &mut Cursor<&[u8]>) -> Result<i32, io::Error> {
+        let value = Self::read_varint(v)?;
+        Ok((value >> 1) as i32 ^ -((value & 1) as i32))
+    }
+
+    fn decode_key(v: &mut Cursor<&[u8]>) -> Result<Self, io::Error> {
+        Ok(Self {
+            seq: Self::read_varint(v)?,
+            time: Self::read_zigzag(v)?,
+            interval: Self::read_zigzag(v)?,
+            water_level: Self::read_varint(v)? as u16,
+            water_distance: Self::read_varint(v)? as u16,
+            temperature: Self::read_zigzag(v)? as i16,
+            voltage: Self::read_varint(v)? as u16,
+        })
+    }
+
+    fn decode(&mut self, v: &mut Cursor<&[u8]>) -> Result<(), io::Error> {
+        self.seq = self.seq.wrapping_add(Self::read_varint(v)?.wrapping_add(1));
+        self.interval = self.interval.wrapping_add(Self::read_zigzag(v)?);
+        self.time = self.time.wrapping_add(self.interval);
+        self.water_level = self.water_level.wrapping_add(Self::read_zigzag(v)? as u16);
+        self.water_distance = self
+            .water_distance
+            .wrapping_add(Self::read_zigzag(v)? as u16);
+        self.temperature = self.temperature.wrapping_add(Self::read_zigzag(v)? as i16);
+        self.voltage = self.voltage.wrapping_add(Self::read_zigzag(v)? as u16);
+        Ok(())
+    }
+
+    fn record(&self, now: SystemTime, uptime: u32) -> HistoryRecord {
+        // Restored records have negative timestamps, so this is always
+        // positive unless the sensor clock is broken
+        let age = (uptime as i64 - self.time as i64).max(0) as u64;
+        HistoryRecord {
+            timestamp: now - Duration::from_secs(age),
+            water_level: self.water_level as f32 / 1000.0,
+            water_distance: self.water_distance as f32 / 1000.0,
+            temperature: self.temperature as f32 / 100.0,
+            battery_voltage: self.voltage as f32 / 1000.0,
+        }
+    }
+}
+
+/// Locations of the sensor characteristics in the BlueZ object tree, which
+/// stay valid as long as the GATT database of the sensor does not change.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct GattCache {
+    /// Database Hash of the sensor when the characteristics were discovered
+    database_hash: Vec<u8>,
+    /// Service and characteristic IDs by characteristic UUID
+    characteristics: HashMap<String, (u16, u16)>,
+}
+
 struct SensorGatt {
     bas_battery_level: bluer::gatt::remote::Characteristic,
     ess_temperature: bluer::gatt::remote::Characteristic,
@@ -35,6 +299,21 @@ struct SensorGatt {
     scs_error: bluer::gatt::remote::Characteristic,
     scs_status: bluer::gatt::remote::Characteristic,
     scs_battery_voltage: bluer::gatt::remote::Characteristic,
+    // Not present on older firmware
+    wls_samples: Option<bluer::gatt::remote::Characteristic>,
+    wls_history: Option<bluer::gatt::remote::Characteristic>,
+    wls_thresholds: Option<bluer::gatt::remote::Characteristic>,
+    wls_flow_rate: Option<bluer::gatt::remote::Characteristic>,
+    wls_leak: Option<bluer::gatt::remote::Characteristic>,
+    scs_period: Option<bluer::gatt::remote::Characteristic>,
+    scs_snapshot: Option<bluer::gatt::remote::Characteristic>,
+    scs_config: Option<bluer::gatt::remote::Characteristic>,
+    scs_adv_stats: Option<bluer::gatt::remote::Characteristic>,
+    scs_conn_stats: Option<bluer::gatt::remote::Characteristic>,
+    scs_energy: Option<bluer::gatt::remote::Characteristic>,
+    scs_timing: Option<bluer::gatt::remote::Characteristic>,
+    scs_crash: Option<bluer::gatt::remote::Characteristic>,
+    scs_watchdog: Option<bluer::gatt::remote::Characteristic>,
 }
 
 /// Object for communicating over Bluetooth Low Energy (BLE) with the water
@@ -42,12 +321,34 @@ struct SensorGatt {
 pub struct Sensor {
     device: bluer::Device,
     gatt: Option<SensorGatt>,
+    gatt_cache: Option<GattCache>,
+    // The cache changed since it was last taken
+    gatt_cache_updated: bool,
 }
 
 impl Sensor {
+    /// Status bit set when the sensor has new data
+    pub const STATUS_NEW_DATA: u32 = 1 << 0;
+    /// Status bit set while the water level is outside the alert thresholds
+    pub const STATUS_ALERT: u32 = 1 << 1;
+    /// Status bit set while the water level keeps dropping at a leak rate
+    pub const STATUS_LEAK: u32 = 1 << 2;
+    /// Status bit set while the battery is low and the sensor measures less
+    /// often or not at all
+    pub const STATUS_LOW_POWER: u32 = 1 << 3;
+
+    // Manufacturer data holding the broadcast measurements
+    const BROADCAST_COMPANY_ID: u16 = 0xffff;
+    const BROADCAST_VERSION: u8 = 1;
+
     // Characteristic Presentation Format
     const CPF_UUID: &'static str = "00002904-0000-1000-8000-00805f9b34fb";
 
+    // Generic Attribute Service, which holds the Database Hash when the sensor
+    // supports GATT caching
+    const GATT_UUID: Uuid = uuid!("00001801-0000-1000-8000-00805f9b34fb");
+    const GATT_DATABASE_HASH_UUID: Uuid = uuid!("00002b2a-0000-1000-8000-00805f9b34fb");
+
     // Battery Service
     const BAS_UUID: Uuid = uuid!("0000180f-0000-1000-8000-00805f9b34fb");
     const BAS_BATTERY_LEVEL_UUID: Uuid = uuid!("00002a19-0000-1000-8000-00805f9b34fb");
@@ -61,19 +362,43 @@ impl Sensor {
     const WLS_WATER_LEVEL_UUID: Uuid = uuid!("7af2e6a5-729a-a1b5-4a4e-6d5799bc4c24");
     const WLS_WATER_DISTANCE_UUID: Uuid = uuid!("fe475554-4784-3b82-9442-a74f062d3101");
     const WLS_TANK_DEPTH_UUID: Uuid = uuid!("d357ee3d-765c-debf-8c49-4a2fcbecc6d3");
+    const WLS_SAMPLES_UUID: Uuid = uuid!("8163b323-6203-4dba-9824-c13385745fd0");
+    const WLS_HISTORY_UUID: Uuid = uuid!("a0ee393e-fc25-4c28-8200-e88697027dcf");
+    const WLS_THRESHOLDS_UUID: Uuid = uuid!("fc2fefe6-c5ad-4a9e-b8dc-0a59bd9f797d");
+    const WLS_FLOW_RATE_UUID: Uuid = uuid!("22051155-f118-4e2f-9bb2-1c4d02df3261");
+    const WLS_LEAK_UUID: Uuid = uuid!("1268d39d-31d4-479d-831d-7c75ad9848d5");
 
     // System Control Service
     const SCS_UUID: Uuid = uuid!("89efdfcb-9661-888e-724e-c0a20f20f8a1");
     const SCS_ERROR_UUID: Uuid = uuid!("c25f2f83-847b-c6bd-a74a-cbc37714f1e3");
     const SCS_STATUS_UUID: Uuid = uuid!("57c15dae-edd4-c195-284b-61f909f5325b");
     const SCS_BATTERY_VOLTAGE_UUID: Uuid = uuid!("dd08556b-ad05-7c83-2640-90448b38c121");
+    const SCS_PERIOD_UUID: Uuid = uuid!("cecfb50b-f58d-4caf-9885-5f0890b6a9c0");
+    const SCS_CONFIG_UUID: Uuid = uuid!("2a01aff2-d8e6-411d-bf2d-46c038888f7c");
+    const SCS_SNAPSHOT_UUID: Uuid = uuid!("626df6a7-7953-47ce-9d3d-1eee43a4277c");
+    const SNAPSHOT_VERSION: u8 = 1;
+    const SCS_ADV_STATS_UUID: Uuid = uuid!("38bfef72-7ef3-44e0-970c-556b18c0132f");
+    const SCS_CONN_STATS_UUID: Uuid = uuid!("93d5f958-a0fc-4030-be15-cc5213f74871");
+    const SCS_ENERGY_UUID: Uuid = uuid!("c9a40921-88ab-4470-afd0-2200e11bc0f4");
+    const SCS_TIMING_UUID: Uuid = uuid!("4630cd6c-38e2-44e4-9f08-fc75001b1222");
+    const SCS_CRASH_UUID: Uuid = uuid!("60483339-69f5-4239-801c-6426f3edeb7b");
+    const SCS_WATCHDOG_UUID: Uuid = uuid!("27bf9d5e-a4fc-4473-bd0c-a6ba8f308e51");
+    /// Tasks in the order of the watchdog report: the update stages, then the
+    /// system work queue that runs the Bluetooth stack
+    const WATCHDOG_TASKS: [&'static str; 5] =
+        ["battery", "sensors", "water_level", "publish", "bluetooth"];
 
     async fn new(device: bluer::Device) -> Result<Self, Error> {
         if !device.is_paired().await? {
             return Err(Error::SensorInvalid("not paired".into()));
         }
 
-        Ok(Sensor { device, gatt: None })
+        Ok(Sensor {
+            device,
+            gatt: None,
+            gatt_cache: None,
+            gatt_cache_updated: false,
+        })
     }
 
     pub async fn find_by_address(
@@ -88,80 +413,171 @@ impl Sensor {
         .await
     }
 
-    async fn find_service(
-        services: &mut Vec<bluer::gatt::remote::Service>,
-        uuid: Uuid,
-    ) -> Result<bluer::gatt::remote::Service, Error> {
-        let mut index = None;
-        for (i, service) in services.iter().enumerate() {
-            if service.uuid().await? == uuid {
-                index = Some(i);
-                break;
+    /// Enumerate the characteristics of the services used by the base
+    /// station. Slow, because getting the UUID of every attribute takes a
+    /// D-Bus call.
+    async fn discover_characteristics(
+        &self,
+    ) -> Result<HashMap<Uuid, bluer::gatt::remote::Characteristic>, Error> {
+        let services = [
+            Self::GATT_UUID,
+            Self::BAS_UUID,
+            Self::ESS_UUID,
+            Self::WLS_UUID,
+            Self::SCS_UUID,
+        ];
+        let mut chars = HashMap::new();
+        for service in self.device.services().await? {
+            if !services.contains(&service.uuid().await?) {
+                continue;
+            }
+            for c in service.characteristics().await? {
+                chars.insert(c.uuid().await?, c);
             }
         }
-        index
-            .map(|i| services.swap_remove(i))
-            .ok_or(Error::GattAttributeNotFound(uuid))
+        Ok(chars)
     }
 
-    async fn find_characteristic(
-        chars: &mut Vec<bluer::gatt::remote::Characteristic>,
-        uuid: Uuid,
-    ) -> Result<bluer::gatt::remote::Characteristic, Error> {
-        let mut index = None;
-        for (i, c) in chars.iter().enumerate() {
-            if c.uuid().await? == uuid {
-                index = Some(i);
-                break;
+    /// Look the characteristics up by the IDs remembered in the cache.
+    /// Returns `None` if the database hash of the sensor changed since.
+    async fn cached_characteristics(
+        &self,
+        cache: &GattCache,
+    ) -> Result<Option<HashMap<Uuid, bluer::gatt::remote::Characteristic>>, Error> {
+        let Some(&(service_id, id)) = cache
+            .characteristics
+            .get(&Self::GATT_DATABASE_HASH_UUID.to_string())
+        else {
+            return Ok(None);
+        };
+        let hash = self
+            .device
+            .service(service_id)
+            .await?
+            .characteristic(id)
+            .await?
+            .read()
+            .await?;
+        if hash != cache.database_hash {
+            return Ok(None);
+        }
+
+        let mut chars = HashMap::new();
+        for (uuid, &(service_id, id)) in &cache.characteristics {
+            let Ok(uuid) = Uuid::parse_str(uuid) else {
+                return Ok(None);
+            };
+            let c = self
+                .device
+                .service(service_id)
+                .await?
+                .characteristic(id)
+                .await?;
+            chars.insert(uuid, c);
+        }
+        Ok(Some(chars))
+    }
+
+    /// Remember the IDs of the discovered characteristics along with the
+    /// database hash they are valid for. Sensors without a database hash are
+    /// not cached, since they could change their attributes unnoticed.
+    async fn update_gatt_cache(
+        &mut self,
+        chars: &HashMap<Uuid, bluer::gatt::remote::Characteristic>,
+    ) {
+        self.gatt_cache = None;
+        let Some(hash) = chars.get(&Self::GATT_DATABASE_HASH_UUID) else {
+            log::info!("sensor does not support GATT caching");
+            return;
+        };
+        match hash.read().await {
+            Ok(database_hash) => {
+                self.gatt_cache = Some(GattCache {
+                    database_hash,
+                    characteristics: chars
+                        .iter()
+                        .map(|(uuid, c)| (uuid.to_string(), (c.service_id(), c.id())))
+                        .collect(),
+                });
+                self.gatt_cache_updated = true;
             }
+            Err(e) => log::warn!("failed to read database hash: {}", e),
         }
-        index
-            .map(|i| chars.swap_remove(i))
+    }
+
+    fn take_characteristic(
+        chars: &mut HashMap<Uuid, bluer::gatt::remote::Characteristic>,
+        uuid: Uuid,
+    ) -> Result<bluer::gatt::remote::Characteristic, Error> {
+        chars
+            .remove(&uuid)
             .ok_or(Error::GattAttributeNotFound(uuid))
     }
 
     async fn find_gatt_attributes(&mut self) -> Result<(), Error> {
-        let mut services = self.device.services().await?;
-
-        let bas = Self::find_service(&mut services, Self::BAS_UUID).await?;
-        let mut bas_chars = bas.characteristics().await?;
-        let bas_battery_level =
-            Self::find_characteristic(&mut bas_chars, Self::BAS_BATTERY_LEVEL_UUID).await?;
-
-        let ess = Self::find_service(&mut services, Self::ESS_UUID).await?;
-        let mut ess_chars = ess.characteristics().await?;
-        let ess_temperature =
-            Self::find_characteristic(&mut ess_chars, Self::ESS_TEMPERATURE_UUID).await?;
-
-        let wls = Self::find_service(&mut services, Self::WLS_UUID).await?;
-        let mut wls_chars = wls.characteristics().await?;
-        let wls_water_level =
-            Self::find_characteristic(&mut wls_chars, Self::WLS_WATER_LEVEL_UUID).await?;
-        let wls_water_distance =
-            Self::find_characteristic(&mut wls_chars, Self::WLS_WATER_DISTANCE_UUID).await?;
-        let wls_tank_depth =
-            Self::find_characteristic(&mut wls_chars, Self::WLS_TANK_DEPTH_UUID).await?;
-
-        let scs = Self::find_service(&mut services, Self::SCS_UUID).await?;
-        let mut scs_chars = scs.characteristics().await?;
-        let scs_error = Self::find_characteristic(&mut scs_chars, Self::SCS_ERROR_UUID).await?;
-        let scs_status = Self::find_characteristic(&mut scs_chars, Self::SCS_STATUS_UUID).await?;
-        let scs_battery_voltage =
-            Self::find_characteristic(&mut scs_chars, Self::SCS_BATTERY_VOLTAGE_UUID).await?;
+        let cached = match &self.gatt_cache {
+            Some(cache) => self
+                .cached_characteristics(cache)
+                .await
+                .unwrap_or_else(|e| {
+                    log::warn!("failed to use GATT cache: {}", e);
+                    None
+                }),
+            None => None,
+        };
+        let mut chars = match cached {
+            Some(chars) => chars,
+            None => {
+                log::info!("discovering GATT attributes...");
+                let chars = self.discover_characteristics().await?;
+                self.update_gatt_cache(&chars).await;
+                chars
+            }
+        };
+        let c = &mut chars;
 
         self.gatt = Some(SensorGatt {
-            bas_battery_level,
-            ess_temperature,
-            wls_water_level,
-            wls_water_distance,
-            wls_tank_depth,
-            scs_error,
-            scs_status,
-            scs_battery_voltage,
+            bas_battery_level: Self::take_characteristic(c, Self::BAS_BATTERY_LEVEL_UUID)?,
+            ess_temperature: Self::take_characteristic(c, Self::ESS_TEMPERATURE_UUID)?,
+            wls_water_level: Self::take_characteristic(c, Self::WLS_WATER_LEVEL_UUID)?,
+            wls_water_distance: Self::take_characteristic(c, Self::WLS_WATER_DISTANCE_UUID)?,
+            wls_tank_depth: Self::take_characteristic(c, Self::WLS_TANK_DEPTH_UUID)?,
+            scs_error: Self::take_characteristic(c, Self::SCS_ERROR_UUID)?,
+            scs_status: Self::take_characteristic(c, Self::SCS_STATUS_UUID)?,
+            scs_battery_voltage: Self::take_characteristic(c, Self::SCS_BATTERY_VOLTAGE_UUID)?,
+            wls_samples: c.remove(&Self::WLS_SAMPLES_UUID),
+            wls_history: c.remove(&Self::WLS_HISTORY_UUID),
+            wls_thresholds: c.remove(&Self::WLS_THRESHOLDS_UUID),
+            wls_flow_rate: c.remove(&Self::WLS_FLOW_RATE_UUID),
+            wls_leak: c.remove(&Self::WLS_LEAK_UUID),
+            scs_period: c.remove(&Self::SCS_PERIOD_UUID),
+            scs_snapshot: c.remove(&Self::SCS_SNAPSHOT_UUID),
+            scs_config: c.remove(&Self::SCS_CONFIG_UUID),
+            scs_adv_stats: c.remove(&Self::SCS_ADV_STATS_UUID),
+            scs_conn_stats: c.remove(&Self::SCS_CONN_STATS_UUID),
+            scs_energy: c.remove(&Self::SCS_ENERGY_UUID),
+            scs_timing: c.remove(&Self::SCS_TIMING_UUID),
+            scs_crash: c.remove(&Self::SCS_CRASH_UUID),
+            scs_watchdog: c.remove(&Self::SCS_WATCHDOG_UUID),
         });
         Ok(())
     }
 
+    /// Look characteristics up by the locations remembered from an earlier
+    /// connection, as long as the database hash of the sensor still matches.
+    pub fn set_gatt_cache(&mut self, cache: GattCache) {
+        self.gatt_cache = Some(cache);
+    }
+
+    /// The characteristic locations, if they were rediscovered since the
+    /// last call. They should be saved for future connections.
+    pub fn take_updated_gatt_cache(&mut self) -> Option<&GattCache> {
+        if !std::mem::take(&mut self.gatt_cache_updated) {
+            return None;
+        }
+        self.gatt_cache.as_ref()
+    }
+
     pub async fn connect(&mut self) -> Result<(), Error> {
         self.device.connect().await?;
         self.find_gatt_attributes().await?;
@@ -169,9 +585,15 @@ impl Sensor {
     }
 
     pub async fn disconnect(&mut self) -> Result<(), Error> {
-        self.device.disconnect().await?;
         self.gatt = None;
-        Ok(())
+        match self.device.disconnect().await {
+            // The sensor disconnects by itself once the data was collected
+            Err(bluer::Error {
+                kind: bluer::ErrorKind::NotConnected,
+                ..
+            }) => Ok(()),
+            r => Ok(r?),
+        }
     }
 
     pub async fn name(&self) -> Result<String, Error> {
@@ -182,27 +604,129 @@ impl Sensor {
         self.device.address()
     }
 
-    pub async fn wait_new_data(&mut self, adapter: &bluer::Adapter) -> Result<(), Error> {
+    fn parse_status(service_data: &HashMap<Uuid, Vec<u8>>) -> Option<u32> {
+        let data = service_data.get(&Self::SCS_UUID)?;
+        Some(u32::from_le_bytes(data.get(..4)?.try_into().ok()?))
+    }
+
+    fn parse_broadcast(manufacturer_data: &HashMap<u16, Vec<u8>>) -> Option<Broadcast> {
+        let mut v = Cursor::new(
+            manufacturer_data
+                .get(&Self::BROADCAST_COMPANY_ID)?
+                .as_slice(),
+        );
+        if v.read_u8().ok()? != Self::BROADCAST_VERSION {
+            return None;
+        }
+        let mut read = || -> Result<Broadcast, io::Error> {
+            let battery_percentage = v.read_u8()?;
+            Ok(Broadcast {
+                status: v.read_u32::<LittleEndian>()?,
+                seq: v.read_u16::<LittleEndian>()?,
+                water_level: v.read_u16::<LittleEndian>()? as f32 / 1000.0,
+                water_distance: v.read_u16::<LittleEndian>()? as f32 / 1000.0,
+                temperature: v.read_i16::<LittleEndian>()? as f32 / 100.0,
+                battery_percentage,
+                battery_voltage: v.read_u16::<LittleEndian>()? as f32 / 1000.0,
+                errors: v.read_u16::<LittleEndian>()? as u32,
+            })
+        };
+        read().ok()
+    }
+
+    /// Wait until the sensor advertises that it has new data, and return its
+    /// status bits. If the sensor broadcasts its measurements, they are
+    /// returned as well, and broadcasts with sequence number
+    /// `last_broadcast_seq` are ignored since their data was already
+    /// collected.
+    pub async fn wait_new_data(
+        &mut self,
+        adapter: &bluer::Adapter,
+        last_broadcast_seq: Option<u16>,
+    ) -> Result<(u32, Option<Broadcast>), Error> {
+        enum Event {
+            Monitor(bluer::monitor::MonitorEvent),
+            Device(bluer::DeviceEvent),
+        }
+
         let mm = adapter.monitor().await?;
-        let mut monitor = mm
+        // Only match the service UUID or the broadcast header, since other
+        // status bits can be set along with the new data bit
+        let monitor = mm
             .register(bluer::monitor::Monitor {
                 monitor_type: bluer::monitor::Type::OrPatterns,
-                patterns: Some(vec![bluer::monitor::Pattern {
-                    start_position: 0,
-                    data_type: 0x21,
-                    content: vec![
-                        0xa1, 0xf8, 0x20, 0x0f, 0xa2, 0xc0, 0x4e, 0x72, 0x8e, 0x88, 0x61, 0x96,
-                        0xcb, 0xdf, 0xef, 0x89, 0x01, 0x00, 0x00, 0x00,
-                    ],
-                }]),
+                patterns: Some(vec![
+                    bluer::monitor::Pattern {
+                        start_position: 0,
+                        data_type: 0x21,
+                        content: vec![
+                            0xa1, 0xf8, 0x20, 0x0f, 0xa2, 0xc0, 0x4e, 0x72, 0x8e, 0x88, 0x61, 0x96,
+                            0xcb, 0xdf, 0xef, 0x89,
+                        ],
+                    },
+                    bluer::monitor::Pattern {
+                        start_position: 0,
+                        data_type: 0xff,
+                        content: [
+                            &Self::BROADCAST_COMPANY_ID.to_le_bytes()[..],
+                            &[Self::BROADCAST_VERSION],
+                        ]
+                        .concat(),
+                    },
+                ]),
                 ..Default::default()
             })
             .await?;
+        // The sensor may already be advertising without the new data bit, in
+        // which case the change only shows up as a property change
+        let device_events = self.device.events().await?;
 
-        while let Some(event) = monitor.next().await {
-            if let bluer::monitor::MonitorEvent::DeviceFound(devid) = event {
-                if self.device.address() == devid.device {
-                    return Ok(());
+        let mut events = std::pin::pin!(futures::stream::select(
+            monitor.map(Event::Monitor),
+            device_events.map(Event::Device)
+        ));
+        while let Some(event) = events.next().await {
+            let (status, broadcast) = match event {
+                Event::Monitor(bluer::monitor::MonitorEvent::DeviceFound(devid))
+                    if self.device.address() == devid.device =>
+                {
+                    let broadcast = self
+                        .device
+                        .manufacturer_data()
+                        .await?
+                        .as_ref()
+                        .and_then(Self::parse_broadcast);
+                    let status = match &broadcast {
+                        Some(b) => Some(b.status),
+                        None => self
+                            .device
+                            .service_data()
+                            .await?
+                            .as_ref()
+                            .and_then(Self::parse_status),
+                    };
+                    (status, broadcast)
+                }
+                Event::Device(bluer::DeviceEvent::PropertyChanged(
+                    bluer::DeviceProperty::ServiceData(data),
+                )) => (Self::parse_status(&data), None),
+                Event::Device(bluer::DeviceEvent::PropertyChanged(
+                    bluer::DeviceProperty::ManufacturerData(data),
+                )) => {
+                    let broadcast = Self::parse_broadcast(&data);
+                    (broadcast.as_ref().map(|b| b.status), broadcast)
+                }
+                _ => (None, None),
+            };
+
+            if let Some(b) = &broadcast {
+                if Some(b.seq) == last_broadcast_seq {
+                    continue;
+                }
+            }
+            if let Some(status) = status {
+                if status & Self::STATUS_NEW_DATA != 0 {
+                    return Ok((status, broadcast));
                 }
             }
         }
@@ -285,4 +809,667 @@ impl Sensor {
         .await
         .map(|l| l as f32 / 1000.0)
     }
+
+    /// Number of rangefinder pings sent and number of valid samples used for
+    /// the last water level measurement, or `None` if the sensor firmware
+    /// does not report them.
+    pub async fn samples(&self) -> Result<Option<(u8, u8)>, Error> {
+        let Some(attr) = &self.gatt()?.wls_samples else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| Ok((v.read_u8()?, v.read_u8()?)))
+            .await
+            .map(Some)
+    }
+
+    /// Water level alert thresholds. Returns the high threshold, low
+    /// threshold and hysteresis in meters. A threshold of 0 is disabled.
+    /// `None` if the sensor firmware does not support alerts.
+    pub async fn thresholds(&self) -> Result<Option<(f32, f32, f32)>, Error> {
+        let Some(attr) = &self.gatt()?.wls_thresholds else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let mut read =
+                || -> Result<f32, io::Error> { Ok(v.read_u16::<LittleEndian>()? as f32 / 1000.0) };
+            Ok((read()?, read()?, read()?))
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Set the water level alert thresholds, in meters.
+    pub async fn set_thresholds(&self, high: f32, low: f32, hysteresis: f32) -> Result<(), Error> {
+        let mut value = Vec::with_capacity(6);
+        for v in [high, low, hysteresis] {
+            value.extend_from_slice(&((v * 1000.0).round() as u16).to_le_bytes());
+        }
+        let attr = self
+            .gatt()?
+            .wls_thresholds
+            .as_ref()
+            .ok_or(Error::GattAttributeNotFound(Self::WLS_THRESHOLDS_UUID))?;
+        attr.write(&value).await?;
+        Ok(())
+    }
+
+    /// Runtime configuration, or `None` if the sensor firmware does not
+    /// support it.
+    pub async fn config(&self) -> Result<Option<SensorConfig>, Error> {
+        let Some(attr) = &self.gatt()?.scs_config else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            Ok(SensorConfig {
+                samples: v.read_u8()?,
+                max_attempts: v.read_u8()?,
+                range: v.read_u16::<LittleEndian>()?,
+                period_min: Duration::from_secs(v.read_u32::<LittleEndian>()? as u64),
+                period_max: Duration::from_secs(v.read_u32::<LittleEndian>()? as u64),
+            })
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Set the runtime configuration. The sensor saves it to flash once it
+    /// stops changing.
+    pub async fn set_config(&self, config: &SensorConfig) -> Result<(), Error> {
+        let attr = self
+            .gatt()?
+            .scs_config
+            .as_ref()
+            .ok_or(Error::GattAttributeNotFound(Self::SCS_CONFIG_UUID))?;
+        let mut value = vec![config.samples, config.max_attempts];
+        value.extend_from_slice(&config.range.to_le_bytes());
+        value.extend_from_slice(&(config.period_min.as_secs() as u32).to_le_bytes());
+        value.extend_from_slice(&(config.period_max.as_secs() as u32).to_le_bytes());
+        attr.write(&value).await?;
+        Ok(())
+    }
+
+    /// Rate of change of the water level in meters per hour, estimated by the
+    /// sensor from its recent measurements. Negative when the tank drains.
+    /// `None` if the sensor firmware does not estimate it.
+    pub async fn flow_rate(&self) -> Result<Option<f32>, Error> {
+        let Some(attr) = &self.gatt()?.wls_flow_rate else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| v.read_i32::<LittleEndian>())
+            .await
+            .map(|r| Some(r as f32 / 100_000.0))
+    }
+
+    /// Whether the water level has been dropping at a leak rate for several
+    /// updates, or `None` if the sensor firmware does not detect leaks.
+    pub async fn leak(&self) -> Result<Option<bool>, Error> {
+        let Some(attr) = &self.gatt()?.wls_leak else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| v.read_u8())
+            .await
+            .map(|l| Some(l != 0))
+    }
+
+    /// Advertising statistics, or `None` if the sensor firmware does not
+    /// support them.
+    pub async fn advertising_stats(&self) -> Result<Option<AdvertisingStats>, Error> {
+        let Some(attr) = &self.gatt()?.scs_adv_stats else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let mut read = || v.read_u32::<LittleEndian>();
+            Ok(AdvertisingStats {
+                cycles: read()?,
+                timeouts: read()?,
+                last_duration: Duration::from_millis(read()? as u64),
+                last_events: read()?,
+                total_duration: Duration::from_secs(read()? as u64),
+                total_events: read()?,
+            })
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Connection statistics, or `None` if the sensor firmware does not
+    /// support them.
+    pub async fn connection_stats(&self) -> Result<Option<ConnectionStats>, Error> {
+        let Some(attr) = &self.gatt()?.scs_conn_stats else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let connections = v.read_u32::<LittleEndian>()?;
+            let last_sync = v.read_u32::<LittleEndian>()?;
+            Ok(ConnectionStats {
+                connections,
+                last_sync: (last_sync != 0).then(|| Duration::from_millis(last_sync as u64)),
+                last_duration: Duration::from_millis(v.read_u32::<LittleEndian>()? as u64),
+                total_duration: Duration::from_secs(v.read_u32::<LittleEndian>()? as u64),
+                interval: Duration::from_micros(v.read_u16::<LittleEndian>()? as u64 * 1250),
+                latency: v.read_u16::<LittleEndian>()?,
+                timeout: Duration::from_millis(v.read_u16::<LittleEndian>()? as u64 * 10),
+            })
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Energy counters, or `None` if the sensor firmware does not support
+    /// them.
+    pub async fn energy(&self) -> Result<Option<EnergyReport>, Error> {
+        let Some(attr) = &self.gatt()?.scs_energy else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let mut read = || v.read_u32::<LittleEndian>();
+            let mut time = || read().map(|t| Duration::from_secs(t as u64));
+            let (rangefinder_time, advertising_time, connected_time) = (time()?, time()?, time()?);
+            let (cpu_active_time, cpu_idle_time) = (time()?, time()?);
+            let (pings, adc_samples, adv_events) = (read()?, read()?, read()?);
+            let mut charge = || read().map(|c| c as f32 / 1000.0);
+            Ok(EnergyReport {
+                rangefinder_time,
+                advertising_time,
+                connected_time,
+                cpu_active_time,
+                cpu_idle_time,
+                pings,
+                adc_samples,
+                adv_events,
+                rangefinder_charge: charge()?,
+                adc_charge: charge()?,
+                radio_charge: charge()?,
+                cpu_charge: charge()?,
+            })
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Durations of the last update, or `None` if the sensor firmware does
+    /// not report them.
+    pub async fn update_timing(&self) -> Result<Option<UpdateTiming>, Error> {
+        let Some(attr) = &self.gatt()?.scs_timing else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let mut read = || {
+                v.read_u16::<LittleEndian>()
+                    .map(|t| Duration::from_millis(t as u64))
+            };
+            Ok(UpdateTiming {
+                battery: read()?,
+                sensors: read()?,
+                water_level: read()?,
+                publish: read()?,
+                total: read()?,
+            })
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Crash record, or `None` if the sensor firmware does not keep one.
+    pub async fn crash_record(&self) -> Result<Option<CrashRecord>, Error> {
+        let Some(attr) = &self.gatt()?.scs_crash else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let resets = v.read_u16::<LittleEndian>()?;
+            let crashes = v.read_u16::<LittleEndian>()?;
+            let reason = v.read_u32::<LittleEndian>()?;
+            let pc = v.read_u32::<LittleEndian>()?;
+            let lr = v.read_u32::<LittleEndian>()?;
+            let uptime = Duration::from_millis(v.read_u32::<LittleEndian>()? as u64);
+            let mut thread = [0u8; 8];
+            v.read_exact(&mut thread)?;
+            let len = thread.iter().position(|&b| b == 0).unwrap_or(thread.len());
+            Ok(CrashRecord {
+                resets,
+                crashes,
+                last: (crashes > 0).then(|| Crash {
+                    reason,
+                    pc,
+                    lr,
+                    uptime,
+                    thread: String::from_utf8_lossy(&thread[..len]).into_owned(),
+                }),
+            })
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Clear the last fatal error, once it has been recorded.
+    pub async fn clear_crash_record(&self) -> Result<(), Error> {
+        let attr = self
+            .gatt()?
+            .scs_crash
+            .as_ref()
+            .ok_or(Error::GattAttributeNotFound(Self::SCS_CRASH_UUID))?;
+        attr.write(&[0x00]).await?;
+        Ok(())
+    }
+
+    /// Watchdog task durations, or `None` if the sensor firmware does not
+    /// track them.
+    pub async fn watchdog_report(&self) -> Result<Option<WatchdogReport>, Error> {
+        let Some(attr) = &self.gatt()?.scs_watchdog else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let resets = v.read_u16::<LittleEndian>()?;
+            let hung = Self::WATCHDOG_TASKS.get(v.read_u8()? as usize).copied();
+            let mut tasks = Vec::with_capacity(Self::WATCHDOG_TASKS.len());
+            for name in Self::WATCHDOG_TASKS {
+                let mut read = || {
+                    v.read_u16::<LittleEndian>()
+                        .map(|t| Duration::from_millis(t as u64))
+                };
+                let worst = read()?;
+                let last_overrun = Some(read()?).filter(|d| !d.is_zero());
+                let overruns = v.read_u16::<LittleEndian>()?;
+                tasks.push(WatchdogTask {
+                    name,
+                    worst,
+                    last_overrun,
+                    overruns,
+                });
+            }
+            Ok(WatchdogReport {
+                resets,
+                hung,
+                tasks,
+            })
+        })
+        .await
+        .map(Some)
+    }
+
+    fn parse_snapshot(mut v: Cursor<&[u8]>) -> Result<Snapshot, io::Error> {
+        // Newer versions only append fields
+        if v.read_u8()? < Self::SNAPSHOT_VERSION {
+            return Err(io::ErrorKind::InvalidData.into());
+        }
+        let battery_percentage = v.read_u8()?;
+        let pings = v.read_u8()?;
+        let samples = v.read_u8()?;
+        Ok(Snapshot {
+            status: v.read_u32::<LittleEndian>()?,
+            errors: v.read_u32::<LittleEndian>()?,
+            flow_rate: v.read_i32::<LittleEndian>()? as f32 / 100_000.0,
+            period: Duration::from_secs(v.read_u32::<LittleEndian>()? as u64),
+            water_level: v.read_u16::<LittleEndian>()? as f32 / 1000.0,
+            water_distance: v.read_u16::<LittleEndian>()? as f32 / 1000.0,
+            tank_depth: v.read_u16::<LittleEndian>()? as f32 / 1000.0,
+            temperature: v.read_i16::<LittleEndian>()? as f32 / 100.0,
+            battery_voltage: v.read_u16::<LittleEndian>()? as f32 / 1000.0,
+            battery_percentage,
+            pings,
+            samples,
+        })
+    }
+
+    /// Read all current values at once. Returns `None` if the sensor firmware
+    /// does not support it, in which case the values have to be read
+    /// individually.
+    pub async fn snapshot(&self) -> Result<Option<Snapshot>, Error> {
+        let Some(attr) = &self.gatt()?.scs_snapshot else {
+            return Ok(None);
+        };
+        self.read_attr(attr, Self::parse_snapshot).await.map(Some)
+    }
+
+    /// Subscribe to snapshots of every new measurement. While subscribed, the
+    /// sensor notifies new data instead of advertising it. The stream ends
+    /// when the connection is lost.
+    pub async fn snapshots(&self) -> Result<impl Stream<Item = Snapshot> + use<>, Error> {
+        let attr = self
+            .gatt()?
+            .scs_snapshot
+            .as_ref()
+            .ok_or(Error::GattAttributeNotFound(Self::SCS_SNAPSHOT_UUID))?;
+        Ok(attr.notify().await?.filter_map(|value| async move {
+            Self::parse_snapshot(Cursor::new(&value))
+                .inspect_err(|_| log::warn!("invalid snapshot notification: {:?}", value))
+                .ok()
+        }))
+    }
+
+    /// Current update period of the sensor, and the minimum and maximum
+    /// period it can choose. `None` if the sensor firmware uses a fixed
+    /// period.
+    pub async fn period(&self) -> Result<Option<(Duration, Duration, Duration)>, Error> {
+        let Some(attr) = &self.gatt()?.scs_period else {
+            return Ok(None);
+        };
+        self.read_attr(attr, |mut v| {
+            let mut read = || -> Result<Duration, io::Error> {
+                Ok(Duration::from_secs(v.read_u32::<LittleEndian>()? as u64))
+            };
+            Ok((read()?, read()?, read()?))
+        })
+        .await
+        .map(Some)
+    }
+
+    /// Set the minimum and maximum update period of the sensor.
+    pub async fn set_period_bounds(&self, min: Duration, max: Duration) -> Result<(), Error> {
+        let mut value = Vec::with_capacity(8);
+        value.extend_from_slice(&(min.as_secs() as u32).to_le_bytes());
+        value.extend_from_slice(&(max.as_secs() as u32).to_le_bytes());
+        let attr = self
+            .gatt()?
+            .scs_period
+            .as_ref()
+            .ok_or(Error::GattAttributeNotFound(Self::SCS_PERIOD_UUID))?;
+        attr.write(&value).await?;
+        Ok(())
+    }
+
+    /// Download the measurement history stored on the sensor, starting at
+    /// `since`. Returns the records and the cursor to pass as `since` next
+    /// time to only get newer records, or `None` if the sensor firmware does
+    /// not keep a history.
+    pub async fn history(
+        &self,
+        since: HistoryCursor,
+    ) -> Result<Option<(Vec<HistoryRecord>, HistoryCursor)>, Error> {
+        let Some(history) = &self.gatt()?.wls_history else {
+            return Ok(None);
+        };
+        let mut records = Vec::new();
+        let mut next = since;
+        loop {
+            history.write(&next.seq.to_le_bytes()).await?;
+            // The sensor takes its uptime when the sequence number is written
+            let now = SystemTime::now();
+            let value = history.read().await?;
+
+            let mut cursor = Cursor::new(value.as_slice());
+            let parse_header = |c: &mut Cursor<&[u8]>| -> Result<(u32, u32, u32), io::Error> {
+                Ok((
+                    c.read_u32::<LittleEndian>()?,
+                    c.read_u32::<LittleEndian>()?,
+                    c.read_u32::<LittleEndian>()?,
+                ))
+            };
+            let (uptime, seq, epoch) =
+                parse_header(&mut cursor).map_err(|_| Error::InvalidData(value.clone()))?;
+
+            // Sequence numbers from before the restart are meaningless, so
+            // download everything
+            if next.epoch.is_some_and(|e| e != epoch) {
+                log::info!("sensor restarted its history, downloading all records");
+                records.clear();
+                next = HistoryCursor {
+                    seq: 0,
+                    epoch: Some(epoch),
+                };
+                continue;
+            }
+            next = HistoryCursor {
+                seq,
+                epoch: Some(epoch),
+            };
+
+            let start = records.len();
+            Self::decode_history(&mut cursor, now, uptime, &mut records)
+                .map_err(|_| Error::InvalidData(value.clone()))?;
+
+            if records.len() == start {
+                break;
+            }
+        }
+        Ok(Some((records, next)))
+    }
+
+    fn decode_history(
+        v: &mut Cursor<&[u8]>,
+        now: SystemTime,
+        uptime: u32,
+        records: &mut Vec<HistoryRecord>,
+    ) -> Result<(), io::Error> {
+        let len = v.get_ref().len() as u64;
+        if v.position() == len {
+            return Ok(());
+        }
+
+        let mut decoder = HistoryDecoder::decode_key(v)?;
+        records.push(decoder.record(now, uptime));
+        while v.position() < len {
+            decoder.decode(v)?;
+            records.push(decoder.record(now, uptime));
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Encoder matching codec.c on the sensor, so streams can be built
+    /// entry by entry.
+    #[derive(Default)]
+    struct HistoryEncoder {
+        last: HistoryDecoder,
+        buf: Vec<u8>,
+    }
+
+    impl HistoryEncoder {
+        fn put_varint(&mut self, mut value: u32) {
+            loop {
+                let byte = (value & 0x7f) as u8;
+                value >>= 7;
+                if value == 0 {
+                    self.buf.push(byte);
+                    return;
+                }
+                self.buf.push(byte | 0x80);
+            }
+        }
+
+        fn put_zigzag(&mut self, value: i32) {
+            self.put_varint(((value << 1) ^ (value >> 31)) as u32);
+        }
+
+        fn key(entry: &HistoryDecoder) -> Self {
+            let mut e = Self {
+                last: entry.clone(),
+                buf: Vec::new(),
+            };
+            e.put_varint(entry.seq);
+            e.put_zigzag(entry.time);
+            e.put_zigzag(entry.interval);
+            e.put_varint(entry.water_level as u32);
+            e.put_varint(entry.water_distance as u32);
+            e.put_zigzag(entry.temperature as i32);
+            e.put_varint(entry.voltage as u32);
+            e
+        }
+
+        /// Append entry, returning the number of bytes it took
+        fn push(&mut self, entry: &HistoryDecoder) -> usize {
+            let start = self.buf.len();
+            let interval = entry.time.wrapping_sub(self.last.time);
+            self.put_varint(entry.seq.wrapping_sub(self.last.seq).wrapping_sub(1));
+            self.put_zigzag(interval.wrapping_sub(self.last.interval));
+            self.put_zigzag(entry.water_level as i32 - self.last.water_level as i32);
+            self.put_zigzag(entry.water_distance as i32 - self.last.water_distance as i32);
+            self.put_zigzag(entry.temperature as i32 - self.last.temperature as i32);
+            self.put_zigzag(entry.voltage as i32 - self.last.voltage as i32);
+            self.last = entry.clone();
+            self.last.interval = interval;
+            self.buf.len() - start
+        }
+    }
+
+    fn entry(
+        seq: u32,
+        time: i32,
+        water_level: u16,
+        water_distance: u16,
+        temperature: i16,
+        voltage: u16,
+    ) -> HistoryDecoder {
+        HistoryDecoder {
+            seq,
+            time,
+            interval: 0,
+            water_level,
+            water_distance,
+            temperature,
+            voltage,
+        }
+    }
+
+    fn assert_entry(decoded: &HistoryDecoder, expected: &HistoryDecoder) {
+        assert_eq!(decoded.seq, expected.seq);
+        assert_eq!(decoded.time, expected.time);
+        assert_eq!(decoded.water_level, expected.water_level);
+        assert_eq!(decoded.water_distance, expected.water_distance);
+        assert_eq!(decoded.temperature, expected.temperature);
+        assert_eq!(decoded.voltage, expected.voltage);
+    }
+
+    /// Decode a stream holding a key followed by entries
+    fn decode_all(buf: &[u8]) -> Result<Vec<HistoryDecoder>, io::Error> {
+        let mut v = Cursor::new(buf);
+        let mut decoder = HistoryDecoder::decode_key(&mut v)?;
+        let mut entries = vec![decoder.clone()];
+        while v.position() < buf.len() as u64 {
+            decoder.decode(&mut v)?;
+            entries.push(decoder.clone());
+        }
+        Ok(entries)
+    }
+
+    #[test]
+    fn key_record() {
+        let mut key = entry(300, 7200, 1234, 766, 2150, 2950);
+        key.interval = 600;
+        let encoder = HistoryEncoder::key(&key);
+        // seq 300 takes two bytes
+        assert_eq!(&encoder.buf[..2], &[0xac, 0x02]);
+
+        let mut v = Cursor::new(encoder.buf.as_slice());
+        let decoded = HistoryDecoder::decode_key(&mut v).unwrap();
+        assert_eq!(v.position(), encoder.buf.len() as u64);
+        assert_entry(&decoded, &key);
+        assert_eq!(decoded.interval, 600);
+
+        let now = SystemTime::UNIX_EPOCH + Duration::from_secs(1_000_000);
+        let record = decoded.record(now, 7800);
+        assert_eq!(record.timestamp, now - Duration::from_secs(600));
+        assert_eq!(record.water_level, 1.234);
+        assert_eq!(record.water_distance, 0.766);
+        assert_eq!(record.temperature, 21.5);
+        assert_eq!(record.battery_voltage, 2.95);
+    }
+
+    #[test]
+    fn delta_of_delta() {
+        let entries = [
+            entry(10, 600, 1000, 1000, 2000, 3000),
+            entry(11, 1200, 1001, 999, 2001, 3000),
+            entry(12, 1800, 1003, 997, 2003, 2999),
+            entry(13, 2400, 1004, 996, 2010, 2999),
+        ];
+        let mut encoder = HistoryEncoder::key(&entries[0]);
+        // The first entry changes the interval from 0 to 600
+        assert_eq!(encoder.push(&entries[1]), 7);
+        // A regular period and small changes take a byte per field
+        for e in &entries[2..] {
+            assert_eq!(encoder.push(e), 6);
+        }
+
+        let decoded = decode_all(&encoder.buf).unwrap();
+        assert_eq!(decoded.len(), entries.len());
+        for (d, e) in decoded.iter().zip(&entries) {
+            assert_entry(d, e);
+        }
+        assert_eq!(decoded[3].interval, 600);
+    }
+
+    #[test]
+    fn negative_deltas() {
+        let entries = [
+            // Restored from flash, so the time is before boot
+            entry(100, -3000, 2000, 500, 150, 3000),
+            // Skipped sequence numbers and a shorter interval
+            entry(105, -2900, 1500, 1000, -50, 2800),
+            entry(106, -2850, 0, 2500, -2000, 2100),
+            // Time crosses zero and the interval grows again
+            entry(107, 600, 65535, 0, i16::MAX, 0),
+            entry(108, 500, 0, 65535, i16::MIN, 65535),
+        ];
+        let mut encoder = HistoryEncoder::key(&entries[0]);
+        for e in &entries[1..] {
+            encoder.push(e);
+        }
+
+        let decoded = decode_all(&encoder.buf).unwrap();
+        assert_eq!(decoded.len(), entries.len());
+        for (d, e) in decoded.iter().zip(&entries) {
+            assert_entry(d, e);
+        }
+        assert_eq!(decoded[4].interval, -100);
+    }
+
+    #[test]
+    fn history_stream() {
+        let entries = [
+            entry(1, 0, 1000, 1000, 2000, 3000),
+            entry(2, 600, 990, 1010, 1990, 2990),
+        ];
+        let mut encoder = HistoryEncoder::key(&entries[0]);
+        encoder.push(&entries[1]);
+
+        let now = SystemTime::UNIX_EPOCH + Duration::from_secs(1_000_000);
+        let mut records = Vec::new();
+        let mut v = Cursor::new(encoder.buf.as_slice());
+        Sensor::decode_history(&mut v, now, 1200, &mut records).unwrap();
+        assert_eq!(records.len(), 2);
+        assert_eq!(records[0].timestamp, now - Duration::from_secs(1200));
+        assert_eq!(records[1].timestamp, now - Duration::from_secs(600));
+        assert_eq!(records[1].water_level, 0.99);
+
+        // An empty stream holds no records
+        let mut v = Cursor::new(&[][..]);
+        Sensor::decode_history(&mut v, now, 1200, &mut records).unwrap();
+        assert_eq!(records.len(), 2);
+    }
+
+    #[test]
+    fn truncated() {
+        let entries = [
+            entry(1, 0, 1000, 1000, 2000, 3000),
+            entry(2, 600, 1500, 500, 2500, 2500),
+        ];
+        let mut encoder = HistoryEncoder::key(&entries[0]);
+        let key_len = encoder.buf.len();
+        encoder.push(&entries[1]);
+
+        // Every cut inside the key or the entry is an error
+        for len in (1..encoder.buf.len()).filter(|&len| len != key_len) {
+            let err = decode_all(&encoder.buf[..len]).unwrap_err();
+            assert_eq!(err.kind(), io::ErrorKind::UnexpectedEof, "length {len}");
+        }
+    }
+
+    #[test]
+    fn corrupt() {
+        // More continuation bytes than a 32-bit varint can have
+        let buf = [0xff, 0xff, 0xff, 0xff, 0xff, 0x01];
+        let err = decode_all(&buf).unwrap_err();
+        assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+
+        // Same in an entry after a valid key
+        let mut encoder = HistoryEncoder::key(&entry(1, 0, 1000, 1000, 2000, 3000));
+        encoder.buf.extend_from_slice(&buf);
+        let err = decode_all(&encoder.buf).unwrap_err();
+        assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+    }
 }
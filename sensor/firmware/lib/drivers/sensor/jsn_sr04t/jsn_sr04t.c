@@ -6,79 +6,140 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/pm/device.h>
 
+#include "jsn_sr04t.h"
+
 LOG_MODULE_REGISTER(jsn_sr04t, CONFIG_SENSOR_LOG_LEVEL);
 
-enum sr04t_state { STATE_OFF, STATE_READY, STATE_WAIT_ECHO_START, STATE_WAIT_ECHO_END };
+// Extra time to wait for the capture backend beyond the echo timeout, so a
+// backend that reports its own timeout is not raced by the semaphore timeout
+#define SR04T_CAPTURE_SLACK_MS 1
+
+#ifdef CONFIG_JSN_SR04T_TEMP_COMPENSATION
+// Speed of sound in dry air: 331.3 m/s + 0.606 m/s per degree Celsius
+#define SR04T_SOUND_SPEED_0C 331300
+#define SR04T_SOUND_SPEED_PER_C 606
+#define SR04T_DEFAULT_AIR_TEMPERATURE_C 20
+
+static uint32_t sr04t_sound_speed(int64_t temperature_millicelsius) {
+    // Keep the result sane if the temperature source is broken
+    temperature_millicelsius = CLAMP(temperature_millicelsius, -40000, 85000);
+    return SR04T_SOUND_SPEED_0C +
+           (int32_t)(temperature_millicelsius * SR04T_SOUND_SPEED_PER_C / 1000);
+}
+#endif
 
-struct sr04t_config {
-    const struct gpio_dt_spec trig_gpio;
-    const struct gpio_dt_spec echo_gpio;
-    const struct gpio_dt_spec supply_gpio;
-};
+static void sr04t_burst_ping_done(const struct device* dev, int err, uint32_t echo_ns);
 
-struct sr04t_data {
-    struct gpio_callback echo_cb;
-    struct k_sem echo_end_sem;
+void sr04t_capture_done(const struct device* dev, int err, uint32_t echo_ns) {
+    struct sr04t_data* data = dev->data;
 
-    enum sr04t_state state;
+    if (data->burst_active) {
+        sr04t_burst_ping_done(dev, err, echo_ns);
+        return;
+    }
 
-    uint32_t echo_start_cycles;
-    uint32_t echo_end_cycles;
-    struct sensor_value value;
-};
+    data->echo_err = err;
+    data->echo_ns = echo_ns;
+    data->state = STATE_READY;
+    k_sem_give(&data->echo_end_sem);
+}
 
-static void sr04t_echo_interrupt(const struct device* port, struct gpio_callback* cb,
-                                 uint32_t pins) {
-    uint32_t cycles = k_cycle_get_32();
+uint32_t sr04t_echo_to_mm(const struct device* dev, uint32_t echo_ns) {
+#ifdef CONFIG_JSN_SR04T_TEMP_COMPENSATION
+    const struct sr04t_data* data = dev->data;
 
-    struct sr04t_data* data = CONTAINER_OF(cb, struct sr04t_data, echo_cb);
+    // Sound travels to the target and back
+    return (uint32_t)(((uint64_t)echo_ns * data->sound_speed) / (2 * NSEC_PER_SEC));
+#else
+    ARG_UNUSED(dev);
 
-    switch (data->state) {
-        case STATE_WAIT_ECHO_START:
-            data->echo_start_cycles = cycles;
-            data->state = STATE_WAIT_ECHO_END;
-            break;
-        case STATE_WAIT_ECHO_END:
-            data->echo_end_cycles = cycles;
-            data->state = STATE_READY;
-            k_sem_give(&data->echo_end_sem);
-            break;
-        default:
-            break;
+    return echo_ns / CONFIG_JSN_SR04T_NS_PER_MM;
+#endif
+}
+
+/**
+ * Convert a distance to the width of its echo.
+ */
+static uint32_t sr04t_mm_to_echo_ns(const struct device* dev, uint32_t distance_mm) {
+#ifdef CONFIG_JSN_SR04T_TEMP_COMPENSATION
+    const struct sr04t_data* data = dev->data;
+
+    return (uint32_t)MIN(((uint64_t)distance_mm * 2 * NSEC_PER_SEC) / data->sound_speed,
+                         UINT32_MAX);
+#else
+    ARG_UNUSED(dev);
+
+    return (uint32_t)MIN((uint64_t)distance_mm * CONFIG_JSN_SR04T_NS_PER_MM, UINT32_MAX);
+#endif
+}
+
+/**
+ * Recompute the echo timeout from the maximum range. Must be called whenever
+ * the range or the speed of sound changes.
+ */
+static void sr04t_update_echo_timeout(const struct device* dev) {
+    struct sr04t_data* data = dev->data;
+
+    if (data->max_range_mm == 0) {
+        data->echo_timeout_us = CONFIG_JSN_SR04T_ECHO_TIMEOUT * USEC_PER_MSEC;
+        return;
     }
+
+    uint32_t timeout_us = sr04t_mm_to_echo_ns(dev, data->max_range_mm) / NSEC_PER_USEC +
+                          CONFIG_JSN_SR04T_ECHO_TIMEOUT_MARGIN_US;
+    data->echo_timeout_us = MIN(timeout_us, CONFIG_JSN_SR04T_ECHO_TIMEOUT_MAX * USEC_PER_MSEC);
 }
 
-int sr04t_sample_fetch(const struct device* dev, enum sensor_channel chan) {
+static int sr04t_trigger(const struct device* dev) {
     int err;
 
     const struct sr04t_config* config = dev->config;
+
+    // Triggering while the echo from an earlier ping is still high would
+    // measure the wrong pulse. This can happen after an echo timeout shorter
+    // than the sensor's own timeout.
+    err = gpio_pin_get(config->echo_gpio.port, config->echo_gpio.pin);
+    if (err < 0) return err;
+    if (err > 0) return -EBUSY;
+
+    err = gpio_pin_set(config->trig_gpio.port, config->trig_gpio.pin, 1);
+    if (err < 0) return err;
+    k_busy_wait(50);
+    return gpio_pin_set(config->trig_gpio.port, config->trig_gpio.pin, 0);
+}
+
+int sr04t_sample_fetch(const struct device* dev, enum sensor_channel chan) {
+    int err;
+
     struct sr04t_data* data = dev->data;
 
     if (chan != SENSOR_CHAN_ALL && chan != SENSOR_CHAN_DISTANCE) return -ENOTSUP;
 
+    if (data->burst_active) return -EBUSY;
+
     pm_device_busy_set(dev);
 
-    err = gpio_pin_set(config->trig_gpio.port, config->trig_gpio.pin, 1);
-    if (err < 0) goto cleanup;
-    k_busy_wait(50);
-    err = gpio_pin_set(config->trig_gpio.port, config->trig_gpio.pin, 0);
-    if (err < 0) goto cleanup;
+    // Wait for the device to start
+    k_sleep(sys_timepoint_timeout(data->ready));
 
-    data->state = STATE_WAIT_ECHO_START;
+    err = sr04t_trigger(dev);
+    if (err < 0) goto cleanup;
 
     k_sem_reset(&data->echo_end_sem);
 
-    err = gpio_pin_interrupt_configure(config->echo_gpio.port,
-                                       config->echo_gpio.pin,
-                                       GPIO_INT_EDGE_BOTH);
+    const uint32_t timeout_us = data->echo_timeout_us;
+    err = sr04t_capture_arm(dev, timeout_us);
     if (err < 0) goto cleanup;
 
     // Wait for interrupt processing to finish
-    // FIXME: triggers a BLE assertion failure under load. I believe this occurs
-    // because a critical section causes excessive BLE interrupt latency. The
-    // normal solution is zero-latency interrupts, but these are not supported
-    // on the Cortex-M0 (no way to disable only certain interrupt priorities).
-    err = k_sem_take(&data->echo_end_sem, K_MSEC(CONFIG_JSN_SR04T_ECHO_TIMEOUT));
+    // FIXME: with the GPIO capture backend, this triggers a BLE assertion
+    // failure under load. I believe this occurs because a critical section
+    // causes excessive BLE interrupt latency. The normal solution is
+    // zero-latency interrupts, but these are not supported on the Cortex-M0
+    // (no way to disable only certain interrupt priorities). The TIMER capture
+    // backend avoids this.
+    err = k_sem_take(&data->echo_end_sem,
+                     K_USEC(timeout_us + SR04T_CAPTURE_SLACK_MS * USEC_PER_MSEC));
     __ASSERT_NO_MSG(err != -EBUSY);
     if (err == -EAGAIN) {
         // Timeout
@@ -88,22 +149,17 @@ int sr04t_sample_fetch(const struct device* dev, enum sensor_channel chan) {
 
     __ASSERT_NO_MSG(STATE_READY == data->state);
 
-    err = gpio_pin_interrupt_configure(config->echo_gpio.port,
-                                       config->echo_gpio.pin,
-                                       GPIO_INT_DISABLE);
+    err = data->echo_err;
     if (err < 0) goto cleanup;
 
-    uint32_t elapsed_cycles = data->echo_end_cycles - data->echo_start_cycles;
-    uint32_t elapsed_ns = k_cyc_to_ns_floor32(elapsed_cycles);
-
-    uint16_t dist_mm = elapsed_ns / CONFIG_JSN_SR04T_NS_PER_MM;
+    uint16_t dist_mm = sr04t_echo_to_mm(dev, data->echo_ns);
 
     data->value.val1 = dist_mm / 1000;
     data->value.val2 = (dist_mm % 1000) * 1000;
 
 cleanup:
 
-    gpio_pin_interrupt_configure(config->echo_gpio.port, config->echo_gpio.pin, GPIO_INT_DISABLE);
+    sr04t_capture_disarm(dev);
     data->state = STATE_READY;
 
     pm_device_busy_clear(dev);
@@ -111,6 +167,171 @@ cleanup:
     return err;
 }
 
+static void sr04t_burst_finish(const struct device* dev, int err) {
+    struct sr04t_data* data = dev->data;
+
+    sr04t_capture_disarm(dev);
+    data->state = STATE_READY;
+    data->burst_active = false;
+
+    pm_device_busy_clear(dev);
+
+    k_poll_signal_raise(data->burst_signal, err < 0 ? err : (int)data->burst_sent);
+}
+
+/**
+ * Record the result of the current burst ping and schedule the next one. Only
+ * the first caller for each ping has any effect.
+ */
+static void sr04t_burst_ping_done(const struct device* dev, int err, uint32_t echo_ns) {
+    struct sr04t_data* data = dev->data;
+
+    if (!atomic_cas(&data->burst_waiting, 1, 0)) return;
+
+    k_work_cancel_delayable(&data->burst_timeout_work);
+    data->state = STATE_READY;
+
+    if (err < 0) {
+        LOG_DBG("Burst ping %zu failed (err %d)", data->burst_index, err);
+        echo_ns = 0;
+    }
+    data->burst.echo_ns[data->burst_index] = echo_ns;
+    ++data->burst_index;
+
+    k_work_schedule(&data->burst_ping_work, data->burst.spacing);
+}
+
+static void sr04t_burst_timeout(struct k_work* work) {
+    struct k_work_delayable* dwork = k_work_delayable_from_work(work);
+    struct sr04t_data* data = CONTAINER_OF(dwork, struct sr04t_data, burst_timeout_work);
+
+    sr04t_burst_ping_done(data->dev, -ETIMEDOUT, 0);
+}
+
+static void sr04t_burst_ping(struct k_work* work) {
+    int err;
+
+    struct k_work_delayable* dwork = k_work_delayable_from_work(work);
+    struct sr04t_data* data = CONTAINER_OF(dwork, struct sr04t_data, burst_ping_work);
+    const struct device* dev = data->dev;
+
+    // Cancelled while this work was pending
+    if (!data->burst_active) return;
+
+    // Clean up after the previous ping
+    sr04t_capture_disarm(dev);
+
+    if (data->burst_index >= data->burst.count) {
+        sr04t_burst_finish(dev, 0);
+        return;
+    }
+
+    if (data->burst_index == 0) {
+        // Don't count the startup time against the burst
+        data->burst_deadline = sys_timepoint_calc(data->burst.timeout);
+    } else if (sys_timepoint_expired(data->burst_deadline)) {
+        LOG_WRN("Burst timed out after %zu pings", data->burst_index);
+        // Pings that never ran have no echo
+        for (size_t i = data->burst_index; i < data->burst.count; ++i) {
+            data->burst.echo_ns[i] = 0;
+        }
+        sr04t_burst_finish(dev, 0);
+        return;
+    }
+
+    err = sr04t_trigger(dev);
+    if (err == -EBUSY) {
+        // Echo line still busy, count it as a failed ping and try again later
+        atomic_set(&data->burst_waiting, 1);
+        sr04t_burst_ping_done(dev, err, 0);
+        return;
+    } else if (err < 0) {
+        sr04t_burst_finish(dev, err);
+        return;
+    }
+    ++data->burst_sent;
+
+    atomic_set(&data->burst_waiting, 1);
+    const uint32_t timeout_us = data->echo_timeout_us;
+    err = sr04t_capture_arm(dev, timeout_us);
+    if (err < 0) {
+        atomic_clear(&data->burst_waiting);
+        sr04t_burst_finish(dev, err);
+        return;
+    }
+
+    k_work_schedule(&data->burst_timeout_work,
+                    K_USEC(timeout_us + SR04T_CAPTURE_SLACK_MS * USEC_PER_MSEC));
+}
+
+int sr04t_burst_start(const struct device* dev, const struct sr04t_burst* burst,
+                      struct k_poll_signal* signal) {
+    struct sr04t_data* data = dev->data;
+
+    if (data->burst_active || pm_device_is_busy(dev)) return -EBUSY;
+    if (STATE_OFF == data->state) return -EIO;
+
+    pm_device_busy_set(dev);
+
+    data->burst_active = true;
+    data->burst = *burst;
+    data->burst_signal = signal;
+    data->burst_index = 0;
+    data->burst_sent = 0;
+
+    // Start pinging once the device has started
+    k_work_schedule(&data->burst_ping_work, sys_timepoint_timeout(data->ready));
+
+    return 0;
+}
+
+int sr04t_burst_cancel(const struct device* dev) {
+    struct sr04t_data* data = dev->data;
+    struct k_work_sync sync;
+
+    if (!data->burst_active) return -EALREADY;
+
+    // Stop the ping work from continuing the burst, and the capture backend
+    // and timeout work from recording a ping
+    data->burst_active = false;
+    atomic_clear(&data->burst_waiting);
+    k_work_cancel_delayable_sync(&data->burst_ping_work, &sync);
+    k_work_cancel_delayable_sync(&data->burst_timeout_work, &sync);
+
+    sr04t_capture_disarm(dev);
+    data->state = STATE_READY;
+
+    pm_device_busy_clear(dev);
+
+    return 0;
+}
+
+static int sr04t_attr_set(const struct device* dev, enum sensor_channel chan,
+                          enum sensor_attribute attr, const struct sensor_value* val) {
+    struct sr04t_data* data = dev->data;
+
+    if (data->burst_active) return -EBUSY;
+
+    if (chan == SENSOR_CHAN_DISTANCE && attr == SENSOR_ATTR_FULL_SCALE) {
+        const int64_t range_mm = sensor_value_to_milli(val);
+        if (range_mm < 0) return -EINVAL;
+        data->max_range_mm = (uint32_t)MIN(range_mm, UINT32_MAX);
+        sr04t_update_echo_timeout(dev);
+        return 0;
+    }
+
+#ifdef CONFIG_JSN_SR04T_TEMP_COMPENSATION
+    if (chan == SENSOR_CHAN_AMBIENT_TEMP &&
+        attr == (enum sensor_attribute)SENSOR_ATTR_SR04T_AIR_TEMPERATURE) {
+        data->sound_speed = sr04t_sound_speed(sensor_value_to_milli(val));
+        sr04t_update_echo_timeout(dev);
+        return 0;
+    }
+#endif
+
+    return -ENOTSUP;
+}
+
 static int sr04t_channel_get(const struct device* dev, enum sensor_channel chan,
                              struct sensor_value* val) {
     struct sr04t_data* data = dev->data;
@@ -130,20 +351,22 @@ static int sr04t_pm_action(const struct device* dev, enum pm_device_action actio
     struct sr04t_data* data = dev->data;
 
     switch (action) {
-        case PM_DEVICE_ACTION_TURN_ON:
+        case PM_DEVICE_ACTION_RESUME:
             err = gpio_pin_set(config->supply_gpio.port, config->supply_gpio.pin, 1);
             if (err < 0) return err;
-            // Wait for device to start
-            k_sleep(K_MSEC(100));
+            // Measurements wait for the device to start, so the caller can do
+            // something else in the meantime
+            data->ready = sys_timepoint_calc(K_MSEC(CONFIG_JSN_SR04T_STARTUP_TIME));
             data->state = STATE_READY;
             break;
-        case PM_DEVICE_ACTION_TURN_OFF:
+        case PM_DEVICE_ACTION_SUSPEND:
             err = gpio_pin_set(config->supply_gpio.port, config->supply_gpio.pin, 0);
             if (err < 0) return err;
             data->state = STATE_OFF;
             break;
-        case PM_DEVICE_ACTION_SUSPEND:
-        case PM_DEVICE_ACTION_RESUME:
+        case PM_DEVICE_ACTION_TURN_ON:
+        case PM_DEVICE_ACTION_TURN_OFF:
+            // Supply is only switched on while the device is resumed
             break;
         default:
             return -EINVAL;
@@ -158,9 +381,17 @@ static int sr04t_init(const struct device* dev) {
     const struct sr04t_config* config = dev->config;
     struct sr04t_data* data = dev->data;
 
+    data->dev = dev;
     data->state = STATE_OFF;
+#ifdef CONFIG_JSN_SR04T_TEMP_COMPENSATION
+    data->sound_speed = sr04t_sound_speed(SR04T_DEFAULT_AIR_TEMPERATURE_C * 1000);
+#endif
+    data->max_range_mm = 0;
+    sr04t_update_echo_timeout(dev);
 
     k_sem_init(&data->echo_end_sem, 0, 1);
+    k_work_init_delayable(&data->burst_ping_work, sr04t_burst_ping);
+    k_work_init_delayable(&data->burst_timeout_work, sr04t_burst_timeout);
 
     // Trig
     if (!device_is_ready(config->trig_gpio.port)) {
@@ -181,8 +412,7 @@ static int sr04t_init(const struct device* dev) {
                              config->echo_gpio.pin,
                              GPIO_INPUT | config->echo_gpio.dt_flags);
     if (err < 0) return err;
-    gpio_init_callback(&data->echo_cb, sr04t_echo_interrupt, BIT(config->echo_gpio.pin));
-    err = gpio_add_callback(config->echo_gpio.port, &data->echo_cb);
+    err = sr04t_capture_init(dev);
     if (err < 0) return err;
 
     // Enable
@@ -199,26 +429,51 @@ static int sr04t_init(const struct device* dev) {
 }
 
 const struct sensor_driver_api sr04t_api = {
+    .attr_set = &sr04t_attr_set,
     .sample_fetch = &sr04t_sample_fetch,
     .channel_get = &sr04t_channel_get,
 };
 
-#define SR04T_INST(inst)                                           \
-    static struct sr04t_data sr04t_data_##inst;                    \
-                                                                   \
-    static const struct sr04t_config sr04t_config_##inst = {       \
-        .trig_gpio = GPIO_DT_SPEC_INST_GET(inst, trig_gpios),      \
-        .echo_gpio = GPIO_DT_SPEC_INST_GET(inst, echo_gpios),      \
-        .supply_gpio = GPIO_DT_SPEC_INST_GET(inst, supply_gpios)}; \
-                                                                   \
-    PM_DEVICE_DT_INST_DEFINE(inst, sr04t_pm_action);               \
-    SENSOR_DEVICE_DT_INST_DEFINE(inst,                             \
-                                 sr04t_init,                       \
-                                 PM_DEVICE_DT_INST_GET(inst),      \
-                                 &sr04t_data_##inst,               \
-                                 &sr04t_config_##inst,             \
-                                 POST_KERNEL,                      \
-                                 CONFIG_SENSOR_INIT_PRIORITY,      \
+#ifdef CONFIG_JSN_SR04T_CAPTURE_TIMER
+#define SR04T_TIMER_NODE(inst) DT_INST_PHANDLE(inst, timer)
+
+#define SR04T_TIMER_IRQ_CONFIG(inst)                          \
+    static void sr04t_irq_config_##inst(void) {               \
+        IRQ_CONNECT(DT_IRQN(SR04T_TIMER_NODE(inst)),          \
+                    DT_IRQ(SR04T_TIMER_NODE(inst), priority), \
+                    sr04t_timer_isr,                          \
+                    DEVICE_DT_INST_GET(inst),                 \
+                    0);                                       \
+        irq_enable(DT_IRQN(SR04T_TIMER_NODE(inst)));          \
+    }
+
+#define SR04T_TIMER_CONFIG(inst)                                   \
+    .timer = (NRF_TIMER_Type*)DT_REG_ADDR(SR04T_TIMER_NODE(inst)), \
+    .irq_config = sr04t_irq_config_##inst,
+#else
+#define SR04T_TIMER_IRQ_CONFIG(inst)
+#define SR04T_TIMER_CONFIG(inst)
+#endif
+
+#define SR04T_INST(inst)                                          \
+    static struct sr04t_data sr04t_data_##inst;                   \
+                                                                  \
+    SR04T_TIMER_IRQ_CONFIG(inst)                                  \
+                                                                  \
+    static const struct sr04t_config sr04t_config_##inst = {      \
+        .trig_gpio = GPIO_DT_SPEC_INST_GET(inst, trig_gpios),     \
+        .echo_gpio = GPIO_DT_SPEC_INST_GET(inst, echo_gpios),     \
+        .supply_gpio = GPIO_DT_SPEC_INST_GET(inst, supply_gpios), \
+        SR04T_TIMER_CONFIG(inst)};                                \
+                                                                  \
+    PM_DEVICE_DT_INST_DEFINE(inst, sr04t_pm_action);              \
+    SENSOR_DEVICE_DT_INST_DEFINE(inst,                            \
+                                 sr04t_init,                      \
+                                 PM_DEVICE_DT_INST_GET(inst),     \
+                                 &sr04t_data_##inst,              \
+                                 &sr04t_config_##inst,            \
+                                 POST_KERNEL,                     \
+                                 CONFIG_SENSOR_INIT_PRIORITY,     \
                                  &sr04t_api);
 
 DT_INST_FOREACH_STATUS_OKAY(SR04T_INST)
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <app/drivers/sensor/jsn_sr04t.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/sensor.h>
+
+#ifdef CONFIG_JSN_SR04T_CAPTURE_TIMER
+#include <hal/nrf_ppi.h>
+#include <hal/nrf_timer.h>
+#endif
+
+enum sr04t_state { STATE_OFF, STATE_READY, STATE_WAIT_ECHO_START, STATE_WAIT_ECHO_END };
+
+struct sr04t_config {
+    const struct gpio_dt_spec trig_gpio;
+    const struct gpio_dt_spec echo_gpio;
+    const struct gpio_dt_spec supply_gpio;
+#ifdef CONFIG_JSN_SR04T_CAPTURE_TIMER
+    NRF_TIMER_Type* timer;
+    void (*irq_config)(void);
+#endif
+};
+
+struct sr04t_data {
+    const struct device* dev;
+    struct k_sem echo_end_sem;
+
+    enum sr04t_state state;
+    // Time at which the device has started after being resumed
+    k_timepoint_t ready;
+
+    // Result of the last capture, filled in by sr04t_capture_done()
+    int echo_err;
+    uint32_t echo_ns;
+
+#ifdef CONFIG_JSN_SR04T_CAPTURE_GPIO
+    struct gpio_callback echo_cb;
+    uint32_t echo_start_cycles;
+#endif
+#ifdef CONFIG_JSN_SR04T_CAPTURE_TIMER
+    uint8_t gpiote_channel;
+    nrf_ppi_channel_t ppi_rise;
+    nrf_ppi_channel_t ppi_rise_disable;
+    nrf_ppi_channel_t ppi_fall;
+    nrf_ppi_channel_group_t ppi_rise_group;
+#endif
+
+    // Asynchronous burst state
+    bool burst_active;
+    struct sr04t_burst burst;
+    struct k_poll_signal* burst_signal;
+    k_timepoint_t burst_deadline;
+    size_t burst_index;
+    size_t burst_sent;
+    // Set while a burst ping is waiting for its echo. Cleared by whichever of
+    // the capture backend or the timeout work gets there first.
+    atomic_t burst_waiting;
+    struct k_work_delayable burst_ping_work;
+    struct k_work_delayable burst_timeout_work;
+
+    // Maximum range set through SENSOR_ATTR_FULL_SCALE, or 0 if not set
+    uint32_t max_range_mm;
+    // Echo timeout derived from max_range_mm
+    uint32_t echo_timeout_us;
+
+#ifdef CONFIG_JSN_SR04T_TEMP_COMPENSATION
+    // Speed of sound in mm/s
+    uint32_t sound_speed;
+#endif
+
+    struct sensor_value value;
+};
+
+/*
+ * Echo capture backend interface. Exactly one backend is compiled in, selected
+ * by the JSN_SR04T_CAPTURE choice.
+ */
+
+/**
+ * Set up the resources needed to capture echoes. Called once from the driver
+ * init function.
+ */
+int sr04t_capture_init(const struct device* dev);
+
+/**
+ * Start capturing a single echo. The backend must call sr04t_capture_done()
+ * once the echo has ended, or may report -ETIMEDOUT itself if it can detect
+ * that the echo did not end within timeout_us.
+ *
+ * @param timeout_us maximum time from now until the end of the echo
+ */
+int sr04t_capture_arm(const struct device* dev, uint32_t timeout_us);
+
+/**
+ * Stop capturing and release anything started by sr04t_capture_arm(). Must be
+ * safe to call whether or not the capture completed.
+ */
+void sr04t_capture_disarm(const struct device* dev);
+
+/**
+ * Report the result of a capture to the driver core. May be called from an
+ * ISR.
+ *
+ * @param err 0 on success, negative error code otherwise
+ * @param echo_ns width of the echo pulse in nanoseconds
+ */
+void sr04t_capture_done(const struct device* dev, int err, uint32_t echo_ns);
+
+#ifdef CONFIG_JSN_SR04T_CAPTURE_TIMER
+void sr04t_timer_isr(const struct device* dev);
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Emulator for the JSN-SR04T that watches the trigger pin and responds to
+ * pings by driving the echo pin through the GPIO emulator, following a
+ * scripted sequence of distances, dropouts and timeouts. Used to run the
+ * measurement pipeline on native_sim.
+ *
+ * Echo timing uses kernel timers, so CONFIG_SYS_CLOCK_TICKS_PER_SEC needs to
+ * be high enough for the distance resolution of interest.
+ */
+
+#define DT_DRV_COMPAT jsn_sr04t
+
+#include <app/drivers/sensor/jsn_sr04t_emul.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(jsn_sr04t_emul, CONFIG_SENSOR_LOG_LEVEL);
+
+// Delay from the end of the trigger pulse to the start of the echo
+#define SR04T_EMUL_ECHO_DELAY_US 500
+// The real sensor gives up after about this long without an echo
+#define SR04T_EMUL_STUCK_ECHO_US 60000
+
+#ifdef CONFIG_JSN_SR04T_NS_PER_MM
+#define SR04T_EMUL_NS_PER_MM CONFIG_JSN_SR04T_NS_PER_MM
+#else
+// Round trip at 343.4 m/s (20 C), which the driver assumes by default
+#define SR04T_EMUL_NS_PER_MM 5824
+#endif
+
+struct sr04t_emul_config {
+    const struct gpio_dt_spec trig_gpio;
+    const struct gpio_dt_spec echo_gpio;
+};
+
+struct sr04t_emul_data {
+    const struct emul* target;
+
+    const struct sr04t_emul_ping* script;
+    size_t script_len;
+    size_t script_pos;
+    bool repeat;
+
+    size_t pings;
+    uint32_t echo_width_us;
+
+    struct gpio_callback trig_cb;
+    struct k_timer echo_start_timer;
+    struct k_timer echo_end_timer;
+};
+
+static void sr04t_emul_set_echo(const struct emul* target, int value) {
+    const struct sr04t_emul_config* config = target->cfg;
+
+    gpio_emul_input_set(config->echo_gpio.port, config->echo_gpio.pin, value);
+}
+
+static void sr04t_emul_echo_start(struct k_timer* timer) {
+    struct sr04t_emul_data* data = CONTAINER_OF(timer, struct sr04t_emul_data, echo_start_timer);
+
+    sr04t_emul_set_echo(data->target, 1);
+    k_timer_start(&data->echo_end_timer, K_USEC(data->echo_width_us), K_NO_WAIT);
+}
+
+static void sr04t_emul_echo_end(struct k_timer* timer) {
+    struct sr04t_emul_data* data = CONTAINER_OF(timer, struct sr04t_emul_data, echo_end_timer);
+
+    sr04t_emul_set_echo(data->target, 0);
+}
+
+static const struct sr04t_emul_ping* sr04t_emul_next_ping(struct sr04t_emul_data* data) {
+    if (data->script_pos >= data->script_len) {
+        if (!data->repeat || data->script_len == 0) return NULL;
+        data->script_pos = 0;
+    }
+    return &data->script[data->script_pos++];
+}
+
+static void sr04t_emul_ping(const struct emul* target) {
+    struct sr04t_emul_data* data = target->data;
+
+    ++data->pings;
+
+    // A new ping cancels any echo still in progress
+    k_timer_stop(&data->echo_start_timer);
+    k_timer_stop(&data->echo_end_timer);
+    sr04t_emul_set_echo(target, 0);
+
+    const struct sr04t_emul_ping* ping = sr04t_emul_next_ping(data);
+    if (ping == NULL || ping->type == SR04T_EMUL_DROPOUT) {
+        LOG_DBG("Ping %zu: dropout", data->pings);
+        return;
+    }
+
+    if (ping->type == SR04T_EMUL_TIMEOUT) {
+        data->echo_width_us = SR04T_EMUL_STUCK_ECHO_US;
+    } else {
+        data->echo_width_us = ping->distance_mm * SR04T_EMUL_NS_PER_MM / NSEC_PER_USEC;
+    }
+    LOG_DBG("Ping %zu: %u us echo", data->pings, data->echo_width_us);
+
+    k_timer_start(&data->echo_start_timer, K_USEC(SR04T_EMUL_ECHO_DELAY_US), K_NO_WAIT);
+}
+
+/**
+ * Called by the GPIO emulator whenever the driver changes an output on the
+ * trigger port. The sensor pings at the end of the trigger pulse.
+ */
+static void sr04t_emul_trig_changed(const struct device* port, struct gpio_callback* cb,
+                                    uint32_t pins) {
+    struct sr04t_emul_data* data = CONTAINER_OF(cb, struct sr04t_emul_data, trig_cb);
+    const struct sr04t_emul_config* config = data->target->cfg;
+
+    ARG_UNUSED(pins);
+
+    if (gpio_emul_output_get(port, config->trig_gpio.pin) == 0) {
+        sr04t_emul_ping(data->target);
+    }
+}
+
+void sr04t_emul_set_script(const struct emul* target, const struct sr04t_emul_ping* pings,
+                           size_t count, bool repeat) {
+    struct sr04t_emul_data* data = target->data;
+
+    data->script = pings;
+    data->script_len = count;
+    data->script_pos = 0;
+    data->repeat = repeat;
+}
+
+size_t sr04t_emul_get_ping_count(const struct emul* target) {
+    const struct sr04t_emul_data* data = target->data;
+
+    return data->pings;
+}
+
+static int sr04t_emul_init(const struct emul* target, const struct device* parent) {
+    const struct sr04t_emul_config* config = target->cfg;
+    struct sr04t_emul_data* data = target->data;
+
+    ARG_UNUSED(parent);
+
+    if (!device_is_ready(config->trig_gpio.port)) {
+        LOG_ERR_DEVICE_NOT_READY(config->trig_gpio.port);
+        return -ENODEV;
+    }
+    if (!device_is_ready(config->echo_gpio.port)) {
+        LOG_ERR_DEVICE_NOT_READY(config->echo_gpio.port);
+        return -ENODEV;
+    }
+
+    data->target = target;
+    k_timer_init(&data->echo_start_timer, sr04t_emul_echo_start, NULL);
+    k_timer_init(&data->echo_end_timer, sr04t_emul_echo_end, NULL);
+
+    // The GPIO emulator runs callbacks for output changes too
+    gpio_init_callback(&data->trig_cb, sr04t_emul_trig_changed, BIT(config->trig_gpio.pin));
+    return gpio_add_callback(config->trig_gpio.port, &data->trig_cb);
+}
+
+#define SR04T_EMUL_INST(inst)                                          \
+    static struct sr04t_emul_data sr04t_emul_data_##inst;              \
+                                                                       \
+    static const struct sr04t_emul_config sr04t_emul_config_##inst = { \
+        .trig_gpio = GPIO_DT_SPEC_INST_GET(inst, trig_gpios),          \
+        .echo_gpio = GPIO_DT_SPEC_INST_GET(inst, echo_gpios)};         \
+                                                                       \
+    EMUL_DT_INST_DEFINE(inst,                                          \
+                        sr04t_emul_init,                               \
+                        &sr04t_emul_data_##inst,                       \
+                        &sr04t_emul_config_##inst,                     \
+                        NULL,                                          \
+                        NULL);
+
+DT_INST_FOREACH_STATUS_OKAY(SR04T_EMUL_INST)
@@ -0,0 +1,59 @@
+/*
+ * Echo capture backend that timestamps both edges of the echo pulse with
+ * k_cycle_get_32() from the GPIO interrupt. Accuracy depends on interrupt
+ * latency.
+ */
+
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/kernel.h>
+
+#include "jsn_sr04t.h"
+
+static void sr04t_echo_interrupt(const struct device* port, struct gpio_callback* cb,
+                                 uint32_t pins) {
+    uint32_t cycles = k_cycle_get_32();
+
+    struct sr04t_data* data = CONTAINER_OF(cb, struct sr04t_data, echo_cb);
+
+    switch (data->state) {
+        case STATE_WAIT_ECHO_START:
+            data->echo_start_cycles = cycles;
+            data->state = STATE_WAIT_ECHO_END;
+            break;
+        case STATE_WAIT_ECHO_END:
+            sr04t_capture_done(data->dev,
+                               0,
+                               k_cyc_to_ns_floor32(cycles - data->echo_start_cycles));
+            break;
+        default:
+            break;
+    }
+}
+
+int sr04t_capture_init(const struct device* dev) {
+    const struct sr04t_config* config = dev->config;
+    struct sr04t_data* data = dev->data;
+
+    gpio_init_callback(&data->echo_cb, sr04t_echo_interrupt, BIT(config->echo_gpio.pin));
+    return gpio_add_callback(config->echo_gpio.port, &data->echo_cb);
+}
+
+int sr04t_capture_arm(const struct device* dev, uint32_t timeout_us) {
+    const struct sr04t_config* config = dev->config;
+    struct sr04t_data* data = dev->data;
+
+    // Timeout is handled by the driver core waiting on the semaphore
+    ARG_UNUSED(timeout_us);
+
+    data->state = STATE_WAIT_ECHO_START;
+
+    return gpio_pin_interrupt_configure(config->echo_gpio.port,
+                                        config->echo_gpio.pin,
+                                        GPIO_INT_EDGE_BOTH);
+}
+
+void sr04t_capture_disarm(const struct device* dev) {
+    const struct sr04t_config* config = dev->config;
+
+    gpio_pin_interrupt_configure(config->echo_gpio.port, config->echo_gpio.pin, GPIO_INT_DISABLE);
+}
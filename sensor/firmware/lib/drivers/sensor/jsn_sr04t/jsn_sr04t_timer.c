@@ -0,0 +1,210 @@
+/*
+ * Echo capture backend that timestamps both edges of the echo pulse in
+ * hardware using GPIOTE, PPI and a TIMER, so the result does not depend on
+ * interrupt latency.
+ *
+ * A GPIOTE channel generates an event on every edge of the echo pin. That
+ * event is connected through three PPI channels:
+ *  - ppi_rise: captures the timer into CC[0]. This channel is the only member
+ *    of ppi_rise_group.
+ *  - ppi_rise_disable: disables ppi_rise_group, so only the first (rising)
+ *    edge is captured into CC[0].
+ *  - ppi_fall: captures the timer into CC[1] on every edge, so it ends up
+ *    holding the time of the last (falling) edge.
+ *
+ * The GPIOTE channel also interrupts the CPU on each edge. The first only
+ * marks the start of the echo, the second ends the ping right away, without
+ * waiting for the rest of the timeout. The timestamps come from the captures,
+ * so the interrupt latency does not matter.
+ *
+ * CC[2] holds the capture window. When the timer reaches it without a falling
+ * edge, the timer stops and raises an interrupt that ends the ping instead.
+ */
+
+#include <hal/nrf_gpiote.h>
+#include <nrfx_gpiote.h>
+#include <nrfx_ppi.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "jsn_sr04t.h"
+
+LOG_MODULE_DECLARE(jsn_sr04t, CONFIG_SENSOR_LOG_LEVEL);
+
+// 16 MHz / 2^4 = 1 MHz, which lets a 16-bit timer (TIMER1/2 on the nRF51)
+// cover 65 ms with 1 us (0.17 mm) resolution
+#define SR04T_TIMER_PRESCALER 4
+#define SR04T_TIMER_NS_PER_TICK 1000
+#define SR04T_TIMER_MAX_TICKS UINT16_MAX
+
+#define SR04T_CC_RISE NRF_TIMER_CC_CHANNEL0
+#define SR04T_CC_FALL NRF_TIMER_CC_CHANNEL1
+#define SR04T_CC_WINDOW NRF_TIMER_CC_CHANNEL2
+
+static const nrfx_gpiote_t gpiote = NRFX_GPIOTE_INSTANCE(0);
+
+/**
+ * End the ping, from either the falling edge or the end of the window.
+ */
+static void sr04t_timer_complete(const struct device* dev) {
+    const struct sr04t_config* config = dev->config;
+    struct sr04t_data* data = dev->data;
+
+    // The falling edge and the end of the window can race, only the first one
+    // completes the ping
+    const unsigned int key = irq_lock();
+    const bool capturing =
+        data->state == STATE_WAIT_ECHO_START || data->state == STATE_WAIT_ECHO_END;
+    if (capturing) {
+        data->state = STATE_READY;
+    }
+    irq_unlock(key);
+    if (!capturing) return;
+
+    nrf_timer_task_trigger(config->timer, NRF_TIMER_TASK_STOP);
+
+    uint32_t rise = nrf_timer_cc_get(config->timer, SR04T_CC_RISE);
+    uint32_t fall = nrf_timer_cc_get(config->timer, SR04T_CC_FALL);
+
+    // No edge leaves both captures at zero, and a rising edge without a
+    // falling edge leaves both captures equal
+    if (fall <= rise) {
+        sr04t_capture_done(dev, -ETIMEDOUT, 0);
+        return;
+    }
+
+    sr04t_capture_done(dev, 0, (fall - rise) * SR04T_TIMER_NS_PER_TICK);
+}
+
+void sr04t_timer_isr(const struct device* dev) {
+    const struct sr04t_config* config = dev->config;
+
+    if (!nrf_timer_event_check(config->timer, NRF_TIMER_EVENT_COMPARE2)) return;
+    nrf_timer_event_clear(config->timer, NRF_TIMER_EVENT_COMPARE2);
+
+    sr04t_timer_complete(dev);
+}
+
+static void sr04t_timer_echo_edge(nrfx_gpiote_pin_t pin, nrfx_gpiote_trigger_t trigger,
+                                  void* context) {
+    const struct device* dev = context;
+    struct sr04t_data* data = dev->data;
+
+    ARG_UNUSED(pin);
+    ARG_UNUSED(trigger);
+
+    // Both edges were already captured by PPI, so only the falling edge
+    // needs to do anything
+    const unsigned int key = irq_lock();
+    const bool rising = data->state == STATE_WAIT_ECHO_START;
+    if (rising) {
+        data->state = STATE_WAIT_ECHO_END;
+    }
+    irq_unlock(key);
+
+    if (!rising) {
+        sr04t_timer_complete(dev);
+    }
+}
+
+int sr04t_capture_init(const struct device* dev) {
+    const struct sr04t_config* config = dev->config;
+    struct sr04t_data* data = dev->data;
+
+    if (nrfx_gpiote_channel_alloc(&gpiote, &data->gpiote_channel) != NRFX_SUCCESS ||
+        nrfx_ppi_channel_alloc(&data->ppi_rise) != NRFX_SUCCESS ||
+        nrfx_ppi_channel_alloc(&data->ppi_rise_disable) != NRFX_SUCCESS ||
+        nrfx_ppi_channel_alloc(&data->ppi_fall) != NRFX_SUCCESS ||
+        nrfx_ppi_group_alloc(&data->ppi_rise_group) != NRFX_SUCCESS) {
+        LOG_ERR("Failed to allocate GPIOTE/PPI resources");
+        return -ENOMEM;
+    }
+
+    const nrfx_gpiote_trigger_config_t trigger_config = {
+        .trigger = NRFX_GPIOTE_TRIGGER_TOGGLE,
+        .p_in_channel = &data->gpiote_channel,
+    };
+    const nrfx_gpiote_handler_config_t handler_config = {
+        .handler = sr04t_timer_echo_edge,
+        .p_context = (void*)dev,
+    };
+    const nrfx_gpiote_input_pin_config_t input_config = {
+        .p_trigger_config = &trigger_config,
+        .p_handler_config = &handler_config,
+    };
+    if (nrfx_gpiote_input_configure(&gpiote, config->echo_gpio.pin, &input_config) !=
+        NRFX_SUCCESS) {
+        LOG_ERR("Failed to configure echo GPIOTE channel");
+        return -EIO;
+    }
+
+    const uint32_t echo_event = nrfx_gpiote_in_event_address_get(&gpiote, config->echo_gpio.pin);
+
+    nrfx_ppi_channel_assign(
+        data->ppi_rise,
+        echo_event,
+        nrf_timer_task_address_get(config->timer, nrf_timer_capture_task_get(SR04T_CC_RISE)));
+    nrfx_ppi_channel_assign(data->ppi_rise_disable,
+                            echo_event,
+                            nrfx_ppi_task_addr_group_disable_get(data->ppi_rise_group));
+    nrfx_ppi_channel_assign(
+        data->ppi_fall,
+        echo_event,
+        nrf_timer_task_address_get(config->timer, nrf_timer_capture_task_get(SR04T_CC_FALL)));
+    nrfx_ppi_channel_include_in_group(data->ppi_rise, data->ppi_rise_group);
+
+    nrf_timer_task_trigger(config->timer, NRF_TIMER_TASK_STOP);
+    nrf_timer_mode_set(config->timer, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(config->timer, NRF_TIMER_BIT_WIDTH_16);
+    nrf_timer_prescaler_set(config->timer, SR04T_TIMER_PRESCALER);
+    nrf_timer_shorts_enable(config->timer, NRF_TIMER_SHORT_COMPARE2_STOP_MASK);
+    nrf_timer_int_enable(config->timer, NRF_TIMER_INT_COMPARE2_MASK);
+
+    config->irq_config();
+
+    return 0;
+}
+
+int sr04t_capture_arm(const struct device* dev, uint32_t timeout_us) {
+    const struct sr04t_config* config = dev->config;
+    struct sr04t_data* data = dev->data;
+
+    uint32_t window = MIN(DIV_ROUND_UP(timeout_us * NSEC_PER_USEC, SR04T_TIMER_NS_PER_TICK),
+                          SR04T_TIMER_MAX_TICKS);
+
+    data->state = STATE_WAIT_ECHO_START;
+
+    nrf_timer_task_trigger(config->timer, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_cc_set(config->timer, SR04T_CC_RISE, 0);
+    nrf_timer_cc_set(config->timer, SR04T_CC_FALL, 0);
+    nrf_timer_cc_set(config->timer, SR04T_CC_WINDOW, window);
+    nrf_timer_event_clear(config->timer, NRF_TIMER_EVENT_COMPARE2);
+    // An enabled IN event keeps the HFCLK running, so it is only enabled while
+    // capturing. Enabling it can generate an event, so clear it before the
+    // PPI channels and the interrupt see it.
+    nrfx_gpiote_trigger_enable(&gpiote, config->echo_gpio.pin, false);
+    nrf_gpiote_event_clear(NRF_GPIOTE, nrf_gpiote_in_event_get(data->gpiote_channel));
+
+    nrfx_ppi_group_enable(data->ppi_rise_group);
+    nrfx_ppi_channel_enable(data->ppi_rise_disable);
+    nrfx_ppi_channel_enable(data->ppi_fall);
+
+    nrf_timer_task_trigger(config->timer, NRF_TIMER_TASK_START);
+    nrf_gpiote_int_enable(NRF_GPIOTE, BIT(data->gpiote_channel));
+
+    return 0;
+}
+
+void sr04t_capture_disarm(const struct device* dev) {
+    const struct sr04t_config* config = dev->config;
+    struct sr04t_data* data = dev->data;
+
+    nrf_timer_task_trigger(config->timer, NRF_TIMER_TASK_STOP);
+
+    nrfx_ppi_group_disable(data->ppi_rise_group);
+    nrfx_ppi_channel_disable(data->ppi_rise_disable);
+    nrfx_ppi_channel_disable(data->ppi_fall);
+
+    // Also disables the interrupt
+    nrfx_gpiote_trigger_disable(&gpiote, config->echo_gpio.pin);
+}
@@ -16,26 +16,44 @@ struct nrfx_adc_supply_config {
 
 #define NRFX_ADC_VBG_VOLTAGE 1200
 
+// Conversions averaged for each fetch. The nRF51 ADC has no hardware
+// oversampling, so they are taken back to back as extra samplings.
+#define NRFX_ADC_SUPPLY_OVERSAMPLING DT_INST_PROP(0, oversampling)
+
+BUILD_ASSERT(NRFX_ADC_SUPPLY_OVERSAMPLING >= 1 && NRFX_ADC_SUPPLY_OVERSAMPLING <= 64,
+             "oversampling must be between 1 and 64");
+
 int nrfx_adc_supply_sample_fetch(const struct device* dev, enum sensor_channel chan) {
     const struct nrfx_adc_supply_config* config = dev->config;
     struct nrfx_adc_supply_data* data = dev->data;
 
     if (chan != SENSOR_CHAN_ALL && chan != SENSOR_CHAN_VOLTAGE) return -ENOTSUP;
 
-    int16_t sample = 0;
+    int16_t samples[NRFX_ADC_SUPPLY_OVERSAMPLING] = {0};
     const uint8_t resolution = 10;
 
+    const struct adc_sequence_options options = {
+        .extra_samplings = NRFX_ADC_SUPPLY_OVERSAMPLING - 1,
+    };
     const struct adc_sequence sequence = {
+        .options = &options,
         .channels = BIT(0),
-        .buffer = &sample,
-        .buffer_size = sizeof(sample),
+        .buffer = samples,
+        .buffer_size = sizeof(samples),
         .resolution = resolution,
     };
 
     int err = adc_read(config->adc, &sequence);
     if (err < 0) return err;
 
-    uint32_t millivolts = (((uint32_t)sample) * NRFX_ADC_VBG_VOLTAGE * 3) >> resolution;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(samples); ++i) {
+        sum += samples[i];
+    }
+
+    // Scale the sum before dividing, to keep the resolution gained by averaging
+    uint32_t millivolts = DIV_ROUND_CLOSEST(sum * NRFX_ADC_VBG_VOLTAGE * 3,
+                                            ARRAY_SIZE(samples) << resolution);
 
     data->value.val1 = millivolts / 1000;
     data->value.val2 = (millivolts % 1000) * 1000;
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+
+/*
+ * The maximum range can be set with SENSOR_ATTR_FULL_SCALE on
+ * SENSOR_CHAN_DISTANCE, in meters. The echo timeout is derived from it, so
+ * pings without an echo only cost as long as an echo from the maximum range
+ * would take.
+ */
+
+enum sr04t_sensor_attribute {
+    /**
+     * Air temperature used to compensate the speed of sound, set on
+     * SENSOR_CHAN_AMBIENT_TEMP in degrees Celsius. Requires
+     * CONFIG_JSN_SR04T_TEMP_COMPENSATION.
+     */
+    SENSOR_ATTR_SR04T_AIR_TEMPERATURE = SENSOR_ATTR_PRIV_START,
+};
+
+/**
+ * Request for an asynchronous burst of pings, see sr04t_burst_start().
+ */
+struct sr04t_burst {
+    /** Buffer of @ref count echo widths in ns, set to 0 for pings without an echo */
+    uint32_t* echo_ns;
+    /** Number of pings to send */
+    size_t count;
+    /** Minimum time from the end of one ping to the start of the next */
+    k_timeout_t spacing;
+    /** Time after which the burst is abandoned, measured from the first ping */
+    k_timeout_t timeout;
+};
+
+/**
+ * Start an asynchronous burst of pings. The rangefinder must already be
+ * resumed and must stay resumed until the burst finishes. If it was resumed
+ * recently, the first ping waits until it has started.
+ *
+ * @param burst burst description, must remain valid until the burst finishes
+ * @param signal raised when the burst finishes, with the number of pings
+ *               actually sent or a negative error code as the result. Fewer
+ *               pings than requested are sent if the burst times out.
+ * @return 0 if the burst was started, -EBUSY if a measurement is in progress
+ */
+int sr04t_burst_start(const struct device* dev, const struct sr04t_burst* burst,
+                      struct k_poll_signal* signal);
+
+/**
+ * Stop a burst started by sr04t_burst_start() without raising its signal.
+ * Afterwards the driver no longer touches the burst or its buffer, so they
+ * may go out of scope. Must not be called from an ISR.
+ *
+ * @return 0 if the burst was stopped, -EALREADY if no burst is running
+ */
+int sr04t_burst_cancel(const struct device* dev);
+
+/**
+ * Convert an echo width to a distance.
+ *
+ * @param echo_ns echo width in nanoseconds
+ * @return distance in millimeters
+ */
+uint32_t sr04t_echo_to_mm(const struct device* dev, uint32_t echo_ns);
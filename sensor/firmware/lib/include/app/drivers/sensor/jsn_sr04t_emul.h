@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+
+enum sr04t_emul_ping_type {
+    /** Normal echo for the given distance. Large distances are out of range. */
+    SR04T_EMUL_ECHO,
+    /** No echo pulse at all */
+    SR04T_EMUL_DROPOUT,
+    /** Echo pulse that starts but does not end before the driver times out */
+    SR04T_EMUL_TIMEOUT,
+};
+
+/**
+ * Emulated response to a single ping.
+ */
+struct sr04t_emul_ping {
+    enum sr04t_emul_ping_type type;
+    /** Distance in millimeters, only used for SR04T_EMUL_ECHO */
+    uint32_t distance_mm;
+};
+
+/**
+ * Set the sequence of responses to future pings. Each trigger consumes one
+ * entry. Once the script runs out, it starts again from the beginning if
+ * repeat is set, otherwise every further ping is a dropout.
+ *
+ * @param target rangefinder emulator
+ * @param pings script entries, must remain valid while the script is in use
+ * @param count number of entries
+ * @param repeat whether to loop the script
+ */
+void sr04t_emul_set_script(const struct emul* target, const struct sr04t_emul_ping* pings,
+                           size_t count, bool repeat);
+
+/**
+ * Get the number of times the rangefinder has been triggered.
+ */
+size_t sr04t_emul_get_ping_count(const struct emul* target);
@@ -1,25 +1,37 @@
 #include "battery.h"
 
-#include <zephyr/drivers/adc.h>
+#include <zephyr/devicetree.h>
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/atomic.h>
 
 #include "common.h"
+#include "energy.h"
 
 LOG_MODULE_REGISTER(battery);
 
-static const uint16_t BATTERY_FULL_MILLIVOLTS = 3200;
-static const uint16_t BATTERY_EMPTY_MILLIVOLTS = 1800;
+#define BATTERY_NODE DT_NODELABEL(battery)
+
+#if DT_NODE_HAS_PROP(BATTERY_NODE, ocv_table_millivolts)
+// Open circuit voltage at each tenth of the charge, following the discharge
+// curve of the battery chemistry
+static const uint16_t ocv_table[] = DT_PROP(BATTERY_NODE, ocv_table_millivolts);
+#else
+static const uint16_t ocv_table[] = {1800, 3200};
+#endif
+
+BUILD_ASSERT(ARRAY_SIZE(ocv_table) >= 2, "OCV table needs at least two points");
 
 static struct {
     const struct device* const battery;
-    atomic_t level;    // %
-    atomic_t voltage;  // mV
+    atomic_t level;           // %
+    atomic_t voltage;         // mV
+    atomic_t loaded_voltage;  // mV
 } state = {
-    .battery = DEVICE_DT_GET(DT_NODELABEL(battery)),
+    .battery = DEVICE_DT_GET(BATTERY_NODE),
     .level = ATOMIC_INIT(0),
     .voltage = ATOMIC_INIT(0),
+    .loaded_voltage = ATOMIC_INIT(0),
 };
 
 int battery_init(void) {
@@ -31,27 +43,69 @@ int battery_init(void) {
     return 0;
 }
 
-int battery_update(void) {
+static int battery_measure(uint16_t* voltage) {
     int err;
     RET_ERR(sensor_sample_fetch(state.battery));
+    energy_add_events(ENERGY_ADC_SAMPLE, DT_PROP(BATTERY_NODE, oversampling));
 
     struct sensor_value voltage_value;
     RET_ERR(sensor_channel_get(state.battery, SENSOR_CHAN_VOLTAGE, &voltage_value));
 
-    uint32_t voltage = voltage_value.val1 * 1000 + voltage_value.val2 / 1000;
-    voltage = MIN(voltage, UINT16_MAX);
+    *voltage = MIN(sensor_value_to_milli(&voltage_value), UINT16_MAX);
+
+    return 0;
+}
+
+/**
+ * Interpolate the charge level along the discharge curve.
+ */
+static uint8_t battery_level_for(uint16_t voltage) {
+    const size_t last = ARRAY_SIZE(ocv_table) - 1;
+
+    if (voltage <= ocv_table[0]) return 0;
+    if (voltage >= ocv_table[last]) return 100;
+
+    size_t i = 0;
+    while (voltage >= ocv_table[i + 1]) {
+        ++i;
+    }
+
+    const uint32_t step = ocv_table[i + 1] - ocv_table[i];
+    return (i * 100 + (voltage - ocv_table[i]) * 100 / step) / last;
+}
+
+int battery_update_loaded(void) {
+    int err;
+    uint16_t voltage;
+    RET_ERR(battery_measure(&voltage));
+
+    atomic_set(&state.loaded_voltage, voltage);
+
+    LOG_DBG("Battery voltage under load: %u mV", voltage);
+
+    return 0;
+}
+
+int battery_update(void) {
+    int err;
+    uint16_t voltage;
+    RET_ERR(battery_measure(&voltage));
     atomic_set(&state.voltage, voltage);
 
-    uint32_t level = (voltage - BATTERY_EMPTY_MILLIVOLTS) * 100 /
-                     (BATTERY_FULL_MILLIVOLTS - BATTERY_EMPTY_MILLIVOLTS);
-    level = MIN(level, 100);
+    // Until it is measured under load, the resting voltage is the best
+    // estimate
+    atomic_set(&state.loaded_voltage, voltage);
+
+    const uint8_t level = battery_level_for(voltage);
     atomic_set(&state.level, level);
 
-    LOG_DBG("Battery state: %d%%, %d.%d V", level, voltage_value.val1, voltage_value.val2);
+    LOG_DBG("Battery state: %u%%, %u mV", level, voltage);
 
     return 0;
 }
 
 uint8_t battery_get_level(void) { return (uint8_t)atomic_get(&state.level); }
 
-uint16_t battery_get_voltage(void) { return (uint16_t)atomic_get(&state.voltage); }
\ No newline at end of file
+uint16_t battery_get_voltage(void) { return (uint16_t)atomic_get(&state.voltage); }
+
+uint16_t battery_get_loaded_voltage(void) { return (uint16_t)atomic_get(&state.loaded_voltage); }
\ No newline at end of file
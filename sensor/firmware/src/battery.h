@@ -4,8 +4,18 @@
 
 int battery_init(void);
 
+/**
+ * Measure the battery at rest, and estimate its charge from the discharge
+ * curve.
+ */
 int battery_update(void);
 
+/**
+ * Measure the battery while the rangefinder is powered, when the supply sags
+ * the most. Must be called after battery_update() in the same update.
+ */
+int battery_update_loaded(void);
+
 /**
  * Get the battery level as a percentage.
  *
@@ -18,4 +28,12 @@ uint8_t battery_get_level(void);
  *
  * @return voltage in millivolts
  */
-uint16_t battery_get_voltage(void);
\ No newline at end of file
+uint16_t battery_get_voltage(void);
+
+/**
+ * Get the battery voltage under load in millivolts, or at rest if it was not
+ * measured under load since the last battery_update().
+ *
+ * @return voltage in millivolts
+ */
+uint16_t battery_get_loaded_voltage(void);
\ No newline at end of file
@@ -11,7 +11,15 @@
 
 #include "battery.h"
 #include "common.h"
+#include "crash.h"
+#include "energy.h"
+#include "history.h"
+#include "pipeline.h"
+#include "power.h"
+#include "schedule.h"
 #include "temperature.h"
+#include "trend.h"
+#include "watchdog.h"
 #include "water_level.h"
 
 LOG_MODULE_REGISTER(bluetooth);
@@ -26,13 +34,141 @@ LOG_MODULE_REGISTER(bluetooth);
 #define BT_UUID_SCS_VAL \
     0xa1, 0xf8, 0x20, 0x0f, 0xa2, 0xc0, 0x4e, 0x72, 0x8e, 0x88, 0x61, 0x96, 0xcb, 0xdf, 0xef, 0x89
 
+// Status bits that clients can write, the others reflect the sensor state
+#define STATUS_WRITABLE STATUS_NEW_DATA
+
 static atomic_t error = ATOMIC_INIT(0);
 
+#ifdef CONFIG_BLUETOOTH_BROADCAST
+// Company ID reserved for testing, the data is only meant for our base station
+#define BROADCAST_COMPANY_ID 0xffff
+#define BROADCAST_VERSION 1
+
+// Status and latest measurements, sent as manufacturer data in place of the
+// status service data so the base station can collect them without
+// connecting. The scan response is not used because the base station scans
+// passively. Not authenticated: the advertisement is public anyway and
+// anything that changes the sensor still requires a bonded connection.
+//
+// Fields are ordered so they are naturally aligned without padding, which lets
+// the status word be accessed in place.
+static struct {
+    uint16_t company_id;
+    uint8_t version;
+    uint8_t battery_level;  // %
+    uint32_t status;
+    // Incremented for every measurement, so the base station can tell a new
+    // measurement from a repeated advertisement and notice missed ones
+    uint16_t seq;
+    uint16_t water_level;  // mm
+    uint16_t water_distance;  // mm
+    int16_t temperature;  // 0.01 C
+    uint16_t battery_voltage;  // mV
+    // Low 16 error bits
+    uint16_t errors;
+} broadcast_data = {
+    .company_id = BROADCAST_COMPANY_ID,
+    .version = BROADCAST_VERSION,
+};
+static uint32_t* adv_status = &broadcast_data.status;
+
+static void bluetooth_broadcast_end(struct k_work* work);
+
+K_WORK_DELAYABLE_DEFINE(broadcast_work, bluetooth_broadcast_end);
+#else
 static uint8_t status_sd_data[] = {BT_UUID_SCS_VAL, 0x00, 0x00, 0x00, 0x00};
-static uint32_t* status = (uint32_t*)&status_sd_data[16];
+static uint32_t* adv_status = (uint32_t*)&status_sd_data[16];
+#endif
+
+// Status bits, which any thread can change. The copy in the advertising data
+// is only updated by adv_update_work.
+static atomic_t status = ATOMIC_INIT(0);
 
 static void bluetooth_ready(int err);
 
+static void bluetooth_adv_update(struct k_work* work);
+static void bluetooth_adv_step(struct k_work* work);
+
+// Events handled by adv_update_work
+enum adv_event {
+    // Status changed or a client disconnected
+    ADV_EVENT_STATUS = BIT(0),
+    ADV_EVENT_ALERT = BIT(1),
+    ADV_EVENT_CONNECTED = BIT(2),
+    ADV_EVENT_BROADCAST = BIT(3),
+};
+
+static atomic_t adv_events = ATOMIC_INIT(0);
+
+// The advertising state below is only touched from the system work queue:
+// adv_update_work applies changes requested from other threads, and adv_work
+// and broadcast_work run there too
+K_WORK_DEFINE(adv_update_work, bluetooth_adv_update);
+K_WORK_DELAYABLE_DEFINE(adv_work, bluetooth_adv_step);
+
+// An alert has not been delivered yet
+static bool alert_advertising = false;
+
+// Advertising intervals in 0.625 ms units
+#define ADV_INTERVAL_FAST (CONFIG_BLUETOOTH_ADV_FAST_INTERVAL * 8 / 5)
+#define ADV_INTERVAL_MAX (CONFIG_BLUETOOTH_ADV_MAX_INTERVAL * 8 / 5)
+
+// Advertising cycle, running while there is something to report. Starts with
+// a burst at the fast interval, then doubles the interval every backoff step
+// up to the maximum, and gives up at the timeout until the next measurement.
+static struct {
+    bool active;
+    uint16_t interval;
+    // Uptime when the cycle and the current interval started, in ms
+    int64_t start;
+    int64_t interval_start;
+    // Advertising events sent in this cycle, estimated from the intervals
+    uint32_t events;
+} adv;
+
+// Advertising statistics, read through the SCS advertising characteristic
+static struct {
+    uint32_t cycles;
+    // Cycles that ended without a client collecting the data
+    uint32_t timeouts;
+    // Duration (ms) and advertising events of the last cycle
+    uint32_t last_duration;
+    uint32_t last_events;
+    // Totals since boot, duration in s
+    uint32_t total_duration;
+    uint32_t total_events;
+} adv_stats;
+
+static void bluetooth_conn_idle(struct k_work* work);
+
+// Connection state, indexed by bt_conn_index()
+static struct bluetooth_conn {
+    // Referenced while connected, NULL otherwise
+    struct bt_conn* conn;
+    // Uptime when the client connected and when it collected the data (0 if
+    // not yet), in ms
+    int64_t connected;
+    int64_t collected;
+    // Applies the idle connection policy after the data was collected
+    struct k_work_delayable idle_work;
+} conns[CONFIG_BT_MAX_CONN];
+
+// Connection statistics, read through the SCS connection characteristic
+static struct {
+    uint32_t connections;
+    // Time from connecting until the data was collected (0 if it was not) and
+    // until disconnecting of the last connection, in ms
+    uint32_t last_sync;
+    uint32_t last_duration;
+    // Total connected time since boot in s
+    uint32_t total_duration;
+    // Last negotiated connection interval (1.25 ms), peripheral latency and
+    // supervision timeout (10 ms)
+    uint16_t interval;
+    uint16_t latency;
+    uint16_t timeout;
+} __packed conn_stats;
+
 static ssize_t bluetooth_battery_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
                                       void* buf, uint16_t len, uint16_t offset);
 
@@ -52,6 +188,29 @@ static ssize_t bluetooth_tank_depth_write(struct bt_conn* conn, const struct bt_
                                           const void* buf, uint16_t len, uint16_t offset,
                                           uint8_t flags);
 
+static ssize_t bluetooth_samples_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_thresholds_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                         void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_thresholds_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                          const void* buf, uint16_t len, uint16_t offset,
+                                          uint8_t flags);
+
+static ssize_t bluetooth_flow_rate_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                        void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_leak_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                   void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_history_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_history_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                       const void* buf, uint16_t len, uint16_t offset,
+                                       uint8_t flags);
+
 static ssize_t bluetooth_error_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
                                     void* buf, uint16_t len, uint16_t offset);
 
@@ -68,9 +227,55 @@ static ssize_t bluetooth_status_write(struct bt_conn* conn, const struct bt_gatt
 static ssize_t bluetooth_battery_voltage_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
                                               void* buf, uint16_t len, uint16_t offset);
 
+static ssize_t bluetooth_period_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_period_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      const void* buf, uint16_t len, uint16_t offset,
+                                      uint8_t flags);
+
+static ssize_t bluetooth_config_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_config_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      const void* buf, uint16_t len, uint16_t offset,
+                                      uint8_t flags);
+
+static ssize_t bluetooth_snapshot_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                       void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_adv_stats_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                        void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_conn_stats_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                         void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_energy_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_timing_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_crash_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                    void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_watchdog_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                       void* buf, uint16_t len, uint16_t offset);
+
+static ssize_t bluetooth_crash_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     const void* buf, uint16_t len, uint16_t offset,
+                                     uint8_t flags);
+
+static void bluetooth_snapshot_ccc_changed(const struct bt_gatt_attr* attr, uint16_t value);
+
 static const struct bt_data ad[] = {
     BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-    BT_DATA(BT_DATA_SVC_DATA128, status_sd_data, sizeof(status_sd_data))};
+#ifdef CONFIG_BLUETOOTH_BROADCAST
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, &broadcast_data, sizeof(broadcast_data)),
+#else
+    BT_DATA(BT_DATA_SVC_DATA128, status_sd_data, sizeof(status_sd_data)),
+#endif
+};
 
 static const struct bt_data sd[] = {
     BT_DATA_BYTES(BT_DATA_UUID16_ALL, BT_UUID_16_ENCODE(BT_UUID_BAS_VAL),  // Battery Service
@@ -103,6 +308,27 @@ static struct bt_uuid_128 bt_uuid_wls_water_distance = BT_UUID_INIT_128(
 static struct bt_uuid_128 bt_uuid_wls_tank_depth = BT_UUID_INIT_128(
     0xd3, 0xc6, 0xec, 0xcb, 0x2f, 0x4a, 0x49, 0x8c, 0xbf, 0xde, 0x5c, 0x76, 0x3d, 0xee, 0x57, 0xd3);
 
+// Pings sent and valid samples used for the last measurement, one byte each
+static struct bt_uuid_128 bt_uuid_wls_samples = BT_UUID_INIT_128(
+    0xd0, 0x5f, 0x74, 0x85, 0x33, 0xc1, 0x24, 0x98, 0xba, 0x4d, 0x03, 0x62, 0x23, 0xb3, 0x63, 0x81);
+
+// High and low alert thresholds and hysteresis in mm, see
+// struct water_level_thresholds
+static struct bt_uuid_128 bt_uuid_wls_thresholds = BT_UUID_INIT_128(
+    0x7d, 0x79, 0x9f, 0xbd, 0x59, 0x0a, 0xdc, 0xb8, 0x9e, 0x4a, 0xad, 0xc5, 0xe6, 0xef, 0x2f, 0xfc);
+
+// Write a 32-bit sequence number, then read the history since that record
+static struct bt_uuid_128 bt_uuid_wls_history = BT_UUID_INIT_128(
+    0xcf, 0x7d, 0x02, 0x97, 0x86, 0xe8, 0x00, 0x82, 0x28, 0x4c, 0x25, 0xfc, 0x3e, 0x39, 0xee, 0xa0);
+
+// Signed 32-bit water level rate of change in 0.01 mm/h, negative when draining
+static struct bt_uuid_128 bt_uuid_wls_flow_rate = BT_UUID_INIT_128(
+    0x61, 0x32, 0xdf, 0x02, 0x4d, 0x1c, 0xb2, 0x9b, 0x2f, 0x4e, 0x18, 0xf1, 0x55, 0x11, 0x05, 0x22);
+
+// One byte, 1 if the water level has been dropping at a leak rate
+static struct bt_uuid_128 bt_uuid_wls_leak = BT_UUID_INIT_128(
+    0xd5, 0x48, 0x98, 0xad, 0x75, 0x7c, 0x1d, 0x83, 0x9d, 0x47, 0xd4, 0x31, 0x9d, 0xd3, 0x68, 0x12);
+
 static const struct bt_gatt_cpf wls_water_level_cpf = {.format = BT_CPF_FORMAT_UINT16,
                                                        .exponent = -3};
 
@@ -117,7 +343,19 @@ BT_GATT_SERVICE_DEFINE(
     BT_GATT_CHARACTERISTIC(&bt_uuid_wls_tank_depth.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
                            BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN,
                            bluetooth_tank_depth_read, bluetooth_tank_depth_write, NULL),
-    BT_GATT_CPF(&wls_water_level_cpf), );
+    BT_GATT_CPF(&wls_water_level_cpf),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_wls_samples.uuid, BT_GATT_CHRC_READ, BT_GATT_PERM_READ_AUTHEN,
+                           bluetooth_samples_read, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_wls_history.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN,
+                           bluetooth_history_read, bluetooth_history_write, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_wls_thresholds.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN,
+                           bluetooth_thresholds_read, bluetooth_thresholds_write, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_wls_flow_rate.uuid, BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ_AUTHEN, bluetooth_flow_rate_read, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_wls_leak.uuid, BT_GATT_CHRC_READ, BT_GATT_PERM_READ_AUTHEN,
+                           bluetooth_leak_read, NULL, NULL), );
 
 static struct bt_uuid_128 bt_uuid_scs = BT_UUID_INIT_128(BT_UUID_SCS_VAL);
 
@@ -130,6 +368,47 @@ static struct bt_uuid_128 bt_uuid_scs_status = BT_UUID_INIT_128(
 static struct bt_uuid_128 bt_uuid_scs_battery_voltage = BT_UUID_INIT_128(
     0x21, 0xc1, 0x38, 0x8b, 0x44, 0x90, 0x40, 0x26, 0x83, 0x7c, 0x05, 0xad, 0x6b, 0x55, 0x08, 0xdd);
 
+// Update period, minimum and maximum in seconds. The minimum and maximum are
+// writable.
+static struct bt_uuid_128 bt_uuid_scs_period = BT_UUID_INIT_128(
+    0xc0, 0xa9, 0xb6, 0x90, 0x08, 0x5f, 0x85, 0x98, 0xaf, 0x4c, 0x8d, 0xf5, 0x0b, 0xb5, 0xcf, 0xce);
+
+// All current values in one read, see struct bluetooth_snapshot. Subscribers
+// are notified of every new measurement instead of the sensor advertising it.
+static struct bt_uuid_128 bt_uuid_scs_snapshot = BT_UUID_INIT_128(
+    0x7c, 0x27, 0xa4, 0x43, 0xee, 0x1e, 0x3d, 0x9d, 0xce, 0x47, 0x53, 0x79, 0xa7, 0xf6, 0x6d, 0x62);
+
+// Advertising statistics, six 32-bit values: cycles, timeouts, duration (ms)
+// and events of the last cycle, total duration (s) and total events
+static struct bt_uuid_128 bt_uuid_scs_adv_stats = BT_UUID_INIT_128(
+    0x2f, 0x13, 0xc0, 0x18, 0x6b, 0x55, 0x0c, 0x97, 0xe0, 0x44, 0xf3, 0x7e, 0x72, 0xef, 0xbf, 0x38);
+
+// Sampling policy and update period bounds, see struct bluetooth_config
+static struct bt_uuid_128 bt_uuid_scs_config = BT_UUID_INIT_128(
+    0x7c, 0x8f, 0x88, 0x38, 0xc0, 0x46, 0x2d, 0xbf, 0x1d, 0x41, 0xe6, 0xd8, 0xf2, 0xaf, 0x01, 0x2a);
+
+// Connection statistics: connections, duration until the data was collected
+// and of the last connection (ms), total duration (s) as 32-bit values, then
+// the last negotiated interval, latency and timeout as 16-bit values
+static struct bt_uuid_128 bt_uuid_scs_conn_stats = BT_UUID_INIT_128(
+    0x71, 0x48, 0xf7, 0x13, 0x52, 0xcc, 0x15, 0xbe, 0x30, 0x40, 0xfc, 0xa0, 0x58, 0xf9, 0xd5, 0x93);
+
+// Energy diagnostics, see struct energy_report
+static struct bt_uuid_128 bt_uuid_scs_energy = BT_UUID_INIT_128(
+    0xf4, 0xc0, 0x1b, 0xe1, 0x00, 0x22, 0xd0, 0xaf, 0x70, 0x44, 0xab, 0x88, 0x21, 0x09, 0xa4, 0xc9);
+
+// Durations of the last update, see struct pipeline_timing
+static struct bt_uuid_128 bt_uuid_scs_timing = BT_UUID_INIT_128(
+    0x22, 0x12, 0x1b, 0x00, 0x75, 0xfc, 0x08, 0x9f, 0xe4, 0x44, 0xe2, 0x38, 0x6c, 0xcd, 0x30, 0x46);
+
+// Last fatal error, see struct crash_record. Writing 0 clears it.
+static struct bt_uuid_128 bt_uuid_scs_crash = BT_UUID_INIT_128(
+    0x7b, 0xeb, 0xed, 0xf3, 0x26, 0x64, 0x1c, 0x80, 0x39, 0x42, 0xf5, 0x69, 0x39, 0x33, 0x48, 0x60);
+
+// Task durations tracked by the watchdog, see struct watchdog_report
+static struct bt_uuid_128 bt_uuid_scs_watchdog = BT_UUID_INIT_128(
+    0x51, 0x8e, 0x30, 0x8f, 0xba, 0xa6, 0x0c, 0xbd, 0x73, 0x44, 0xfc, 0xa4, 0x5e, 0x9d, 0xbf, 0x27);
+
 static const struct bt_gatt_cpf scs_battery_voltage_cpf = {.format = BT_CPF_FORMAT_UINT16,
                                                            .exponent = -3};
 
@@ -143,27 +422,144 @@ BT_GATT_SERVICE_DEFINE(
                            bluetooth_status_read, bluetooth_status_write, NULL),
     BT_GATT_CHARACTERISTIC(&bt_uuid_scs_battery_voltage.uuid, BT_GATT_CHRC_READ,
                            BT_GATT_PERM_READ_AUTHEN, bluetooth_battery_voltage_read, NULL, NULL),
-    BT_GATT_CPF(&scs_battery_voltage_cpf), );
+    BT_GATT_CPF(&scs_battery_voltage_cpf),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_period.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN,
+                           bluetooth_period_read, bluetooth_period_write, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_config.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN,
+                           bluetooth_config_read, bluetooth_config_write, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_snapshot.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_READ_AUTHEN, bluetooth_snapshot_read, NULL, NULL),
+    BT_GATT_CCC(bluetooth_snapshot_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE_AUTHEN),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_adv_stats.uuid, BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ_AUTHEN, bluetooth_adv_stats_read, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_conn_stats.uuid, BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ_AUTHEN, bluetooth_conn_stats_read, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_energy.uuid, BT_GATT_CHRC_READ, BT_GATT_PERM_READ_AUTHEN,
+                           bluetooth_energy_read, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_timing.uuid, BT_GATT_CHRC_READ, BT_GATT_PERM_READ_AUTHEN,
+                           bluetooth_timing_read, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_crash.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN,
+                           bluetooth_crash_read, bluetooth_crash_write, NULL),
+    BT_GATT_CHARACTERISTIC(&bt_uuid_scs_watchdog.uuid, BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ_AUTHEN, bluetooth_watchdog_read, NULL, NULL), );
+
+// Connection parameters requested while a client collects the data, so reads
+// and history downloads finish in as few connection events as possible
+#define CONN_FAST_INTERVAL_MIN (CONFIG_BLUETOOTH_CONN_FAST_INTERVAL * 4 / 5)  // 1.25 ms units
+#define CONN_FAST_INTERVAL_MAX (CONN_FAST_INTERVAL_MIN * 2)
+#define CONN_FAST_TIMEOUT 400  // 4 s
+
+// Connection parameters requested by clients that stay connected, such as
+// subscribers. The peripheral only has to wake up every 15 s, and the
+// supervision timeout must exceed twice that.
+#define CONN_SLOW_INTERVAL_MIN 640  // 800 ms
+#define CONN_SLOW_INTERVAL_MAX 800  // 1 s
+#define CONN_SLOW_LATENCY 14
+#define CONN_SLOW_TIMEOUT 3200  // 32 s
+
+static const struct bt_gatt_attr* bluetooth_snapshot_attr(void) {
+    return bt_gatt_find_by_uuid(scs_service.attrs, scs_service.attr_count,
+                                &bt_uuid_scs_snapshot.uuid);
+}
 
-static void bluetooth_conn_count_callback(struct bt_conn* conn, void* data) {
-    struct bt_conn_info info;
-    bt_conn_get_info(conn, &info);
-    if (info.role == BT_CONN_ROLE_PERIPHERAL) {
+static void bluetooth_subscribed_callback(struct bt_conn* conn, void* data) {
+    if (bt_gatt_is_subscribed(conn, bluetooth_snapshot_attr(), BT_GATT_CCC_NOTIFY)) {
         ++*((size_t*)data);
     }
 }
 
-static size_t bluetooth_get_conn_count() {
+/**
+ * Count the connections subscribed to snapshot notifications.
+ */
+static size_t bluetooth_get_subscribed_count(void) {
     size_t count = 0;
-    bt_conn_foreach(BT_CONN_TYPE_ALL, bluetooth_conn_count_callback, &count);
+    bt_conn_foreach(BT_CONN_TYPE_LE, bluetooth_subscribed_callback, &count);
     return count;
 }
 
-static int bluetooth_advertising_start() {
-    LOG_DBG("Starting advertising...");
+static void bluetooth_conn_fast(struct bt_conn* conn) {
+    int err;
+
+    IF_ERR(bt_conn_le_param_update(conn,
+                                   BT_LE_CONN_PARAM(CONN_FAST_INTERVAL_MIN,
+                                                    CONN_FAST_INTERVAL_MAX,
+                                                    0,
+                                                    CONN_FAST_TIMEOUT))) {
+        LOG_WRN("Failed to request fast connection parameters (err %d)", err);
+    }
+}
+
+static void bluetooth_conn_slow(struct bt_conn* conn) {
+    int err;
+
+    IF_ERR(bt_conn_le_param_update(conn,
+                                   BT_LE_CONN_PARAM(CONN_SLOW_INTERVAL_MIN,
+                                                    CONN_SLOW_INTERVAL_MAX,
+                                                    CONN_SLOW_LATENCY,
+                                                    CONN_SLOW_TIMEOUT))) {
+        LOG_WRN("Failed to request slow connection parameters (err %d)", err);
+    }
+}
+
+static void bluetooth_subscribed_param_update(struct bt_conn* conn, void* data) {
+    if (bt_gatt_is_subscribed(conn, bluetooth_snapshot_attr(), BT_GATT_CCC_NOTIFY)) {
+        bluetooth_conn_slow(conn);
+    }
+}
+
+/**
+ * Apply the idle connection policy once a client has collected the data.
+ * Subscribers already requested slow parameters when they subscribed.
+ */
+static void bluetooth_conn_idle(struct k_work* work) {
+    int err;
+    struct k_work_delayable* dwork = k_work_delayable_from_work(work);
+    struct bluetooth_conn* c = CONTAINER_OF(dwork, struct bluetooth_conn, idle_work);
+
+    if (!c->conn || bt_gatt_is_subscribed(c->conn, bluetooth_snapshot_attr(), BT_GATT_CCC_NOTIFY)) {
+        return;
+    }
+
+    if (IS_ENABLED(CONFIG_BLUETOOTH_CONN_IDLE_DISCONNECT)) {
+        LOG_DBG("Data collected, disconnecting");
+        IF_ERR(bt_conn_disconnect(c->conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN)) {
+            LOG_WRN("Failed to disconnect (err %d)", err);
+        }
+    } else {
+        bluetooth_conn_slow(c->conn);
+    }
+}
+
+/**
+ * Record that a client collected the data and schedule the idle connection
+ * policy.
+ */
+static void bluetooth_conn_collected(struct bt_conn* conn) {
+    struct bluetooth_conn* c = &conns[bt_conn_index(conn)];
+
+    if (!c->conn) return;
+    if (c->collected == 0) {
+        c->collected = k_uptime_get();
+    }
+    k_work_reschedule(&c->idle_work, K_MSEC(CONFIG_BLUETOOTH_CONN_IDLE_DELAY));
+}
+
+static void bluetooth_snapshot_ccc_changed(const struct bt_gatt_attr* attr, uint16_t value) {
+    LOG_DBG("Snapshot notifications %s", value == BT_GATT_CCC_NOTIFY ? "enabled" : "disabled");
+    bt_conn_foreach(BT_CONN_TYPE_LE, bluetooth_subscribed_param_update, NULL);
+}
+
+static int bluetooth_advertising_restart(void) {
+    // The interval can only be changed by restarting
+    bt_le_adv_stop();
+
+    LOG_DBG("Advertising every %u ms", adv.interval * 5 / 8);
     return bt_le_adv_start(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONN,
-                                           BT_GAP_ADV_SLOW_INT_MIN,
-                                           BT_GAP_ADV_SLOW_INT_MAX,
+                                           adv.interval,
+                                           adv.interval + adv.interval / 2,
                                            NULL  // undirected advertising
                                            ),
                            ad,
@@ -172,6 +568,145 @@ static int bluetooth_advertising_start() {
                            ARRAY_SIZE(sd));
 }
 
+/**
+ * Add the advertising events sent at the current interval to the cycle.
+ */
+static void bluetooth_adv_account(int64_t now) {
+    adv.events += (uint32_t)((now - adv.interval_start) * 8 / 5 / adv.interval);
+    adv.interval_start = now;
+}
+
+/**
+ * Start a fast advertising burst, starting a new cycle if none is running.
+ *
+ * @param burst duration of the burst in seconds
+ */
+static void bluetooth_adv_burst(uint32_t burst) {
+    int err;
+    const int64_t now = k_uptime_get();
+
+    if (adv.active) {
+        bluetooth_adv_account(now);
+    } else {
+        adv.active = true;
+        adv.start = now;
+        adv.events = 0;
+        ++adv_stats.cycles;
+    }
+
+    // Fast bursts cost too much on a low battery
+    adv.interval = power_get_policy()->slow_advertising ? ADV_INTERVAL_MAX : ADV_INTERVAL_FAST;
+    adv.interval_start = now;
+    IF_ERR(bluetooth_advertising_restart()) {
+        LOG_ERR("Failed to start advertising (err %d)", err);
+    }
+
+    k_work_reschedule(&adv_work, K_SECONDS(burst));
+}
+
+static void bluetooth_adv_end(void) {
+    if (!adv.active) return;
+
+    const int64_t now = k_uptime_get();
+    bluetooth_adv_account(now);
+    k_work_cancel_delayable(&adv_work);
+    bt_le_adv_stop();
+
+    adv.active = false;
+    alert_advertising = false;
+    adv_stats.last_duration = now - adv.start;
+    adv_stats.last_events = adv.events;
+    adv_stats.total_duration += DIV_ROUND_CLOSEST(adv_stats.last_duration, MSEC_PER_SEC);
+    adv_stats.total_events += adv.events;
+    energy_add_time(ENERGY_ADVERTISING, adv_stats.last_duration);
+    energy_add_events(ENERGY_ADV_EVENT, adv.events);
+    LOG_DBG("Advertised for %u ms (%u events)", adv_stats.last_duration, adv.events);
+}
+
+static void bluetooth_adv_step(struct k_work* work) {
+    int err;
+    const int64_t now = k_uptime_get();
+    const int64_t end = adv.start + (int64_t)CONFIG_BLUETOOTH_ADV_TIMEOUT * MSEC_PER_SEC;
+
+    if (CONFIG_BLUETOOTH_ADV_TIMEOUT > 0 && now >= end) {
+        LOG_INF("Advertising timed out");
+        ++adv_stats.timeouts;
+        bluetooth_adv_end();
+        return;
+    }
+
+    if (adv.interval < ADV_INTERVAL_MAX) {
+        bluetooth_adv_account(now);
+        adv.interval = MIN(adv.interval * 2, ADV_INTERVAL_MAX);
+        IF_ERR(bluetooth_advertising_restart()) {
+            LOG_ERR("Failed to restart advertising (err %d)", err);
+        }
+    }
+
+    int64_t next = now + (int64_t)CONFIG_BLUETOOTH_ADV_BACKOFF_STEP * MSEC_PER_SEC;
+    if (CONFIG_BLUETOOTH_ADV_TIMEOUT > 0) {
+        next = MIN(next, end);
+    } else if (adv.interval >= ADV_INTERVAL_MAX) {
+        // Nothing left to do until the cycle ends
+        return;
+    }
+    k_work_reschedule(&adv_work, K_TIMEOUT_ABS_MS(next));
+}
+
+/**
+ * Have adv_update_work handle an event. Can be called from any thread.
+ */
+static void bluetooth_adv_request(enum adv_event event) {
+    atomic_or(&adv_events, event);
+    k_work_submit(&adv_update_work);
+}
+
+static void bluetooth_adv_update(struct k_work* work) {
+    const atomic_val_t events = atomic_clear(&adv_events);
+
+    if (events & ADV_EVENT_CONNECTED) {
+        bluetooth_adv_end();
+        // Nothing to advertise until the client leaves or the status changes
+        if (events == ADV_EVENT_CONNECTED) return;
+    }
+
+#ifdef CONFIG_BLUETOOTH_BROADCAST
+    if (events & ADV_EVENT_BROADCAST) {
+        ++broadcast_data.seq;
+        broadcast_data.water_level = water_level_get();
+        broadcast_data.water_distance = water_level_get_water_distance();
+        broadcast_data.temperature = (int16_t)temperature_get();
+        broadcast_data.battery_level = battery_get_level();
+        broadcast_data.battery_voltage = battery_get_voltage();
+        broadcast_data.errors = (uint16_t)atomic_get(&error);
+
+        k_work_reschedule(&broadcast_work, K_SECONDS(CONFIG_BLUETOOTH_BROADCAST_DURATION));
+    }
+#endif
+
+    // Update the advertising and service data
+    *adv_status = atomic_get(&status);
+    bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+
+    if (events & ADV_EVENT_BROADCAST) {
+        // New measurements get a cycle of their own, starting with a fast
+        // burst and timing out relative to when they were taken
+        bluetooth_adv_end();
+    }
+
+    if (events & ADV_EVENT_ALERT) {
+        alert_advertising = true;
+        bluetooth_adv_burst(CONFIG_BLUETOOTH_ALERT_DURATION);
+    } else if ((*adv_status & STATUS_NEW_DATA) || alert_advertising) {
+        // If there is new data or an alert, start advertising
+        if (!adv.active) {
+            bluetooth_adv_burst(CONFIG_BLUETOOTH_ADV_FAST_DURATION);
+        }
+    } else {
+        bluetooth_adv_end();
+    }
+}
+
 static void bluetooth_connected(struct bt_conn* conn, uint8_t err) {
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
@@ -183,6 +718,20 @@ static void bluetooth_connected(struct bt_conn* conn, uint8_t err) {
 
     LOG_DBG("Connected to: %s", addr);
 
+    // Advertising stops when a client connects, which also means it did its
+    // job
+    bluetooth_adv_request(ADV_EVENT_CONNECTED);
+
+    struct bluetooth_conn* c = &conns[bt_conn_index(conn)];
+    c->conn = bt_conn_ref(conn);
+    c->connected = k_uptime_get();
+    c->collected = 0;
+    ++conn_stats.connections;
+
+    // Speed up the data pull. The central may refuse or pick other
+    // parameters, which bluetooth_le_param_updated() records.
+    bluetooth_conn_fast(conn);
+
     //    IF_ERR(bt_conn_security(conn, BT_SECURITY_FIPS)) {
     //        LOG_ERR("Failed to enable security (err %d)", err);
     //        bt_conn_disconnect(conn, BT_HCI_ERR_INSUFFICIENT_SECURITY);
@@ -195,26 +744,41 @@ static void bluetooth_disconnected(struct bt_conn* conn, uint8_t reason) {
 
     LOG_DBG("Disconnected from: %s", addr);
 
-    // Stop advertising if no one else is connected and the data has been retrieved
-    // We check for a single connection because the connection that triggered this callback is still
-    // included in the list.
-    if (!(*status & STATUS_NEW_DATA)) {
-        size_t conn_count = bluetooth_get_conn_count();
-        if (conn_count <= 1) {
-            int err = bt_le_adv_stop();
-            if (err < 0) {
-                LOG_ERR("Failed to stop advertising (err %d)", err);
-            } else {
-                LOG_DBG("Stopped advertising at disconnect");
-            }
-        } else {
-            LOG_DBG("%zu clients still connected, not stopping advertising", conn_count - 1);
-        }
+    struct bluetooth_conn* c = &conns[bt_conn_index(conn)];
+    k_work_cancel_delayable(&c->idle_work);
+    if (c->conn) {
+        const int64_t now = k_uptime_get();
+        conn_stats.last_sync = c->collected ? c->collected - c->connected : 0;
+        conn_stats.last_duration = now - c->connected;
+        conn_stats.total_duration += DIV_ROUND_CLOSEST(conn_stats.last_duration, MSEC_PER_SEC);
+        energy_add_time(ENERGY_CONNECTED, conn_stats.last_duration);
+        LOG_INF("Connected for %u ms, data collected after %u ms",
+                conn_stats.last_duration,
+                conn_stats.last_sync);
+
+        bt_conn_unref(c->conn);
+        c->conn = NULL;
     }
+
+    // Advertise again if the client left without collecting the data
+    bluetooth_adv_request(ADV_EVENT_STATUS);
+}
+
+static void bluetooth_le_param_updated(struct bt_conn* conn, uint16_t interval, uint16_t latency,
+                                       uint16_t timeout) {
+    LOG_INF("Connection parameters: interval %u us, latency %u, timeout %u ms",
+            interval * 1250,
+            latency,
+            timeout * 10);
+
+    conn_stats.interval = interval;
+    conn_stats.latency = latency;
+    conn_stats.timeout = timeout;
 }
 
 static struct bt_conn_cb conn_callbacks = {.connected = bluetooth_connected,
-                                           .disconnected = bluetooth_disconnected};
+                                           .disconnected = bluetooth_disconnected,
+                                           .le_param_updated = bluetooth_le_param_updated};
 
 static void bluetooth_passkey_display(struct bt_conn* conn, unsigned int passkey) {
     LOG_INF("Passkey: %d", passkey);
@@ -317,6 +881,77 @@ static ssize_t bluetooth_tank_depth_write(struct bt_conn* conn, const struct bt_
     return len;
 }
 
+static ssize_t bluetooth_samples_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      void* buf, uint16_t len, uint16_t offset) {
+    const uint8_t samples[] = {water_level_get_pings(), water_level_get_samples()};
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, samples, sizeof(samples));
+}
+
+static ssize_t bluetooth_thresholds_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                         void* buf, uint16_t len, uint16_t offset) {
+    struct water_level_thresholds thresholds;
+    water_level_get_thresholds(&thresholds);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &thresholds, sizeof(thresholds));
+}
+
+static ssize_t bluetooth_thresholds_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                          const void* buf, uint16_t len, uint16_t offset,
+                                          uint8_t flags) {
+    struct water_level_thresholds thresholds;
+
+    if (offset + len > sizeof(thresholds)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    water_level_get_thresholds(&thresholds);
+    memcpy(((uint8_t*)&thresholds) + offset, buf, len);
+    if (water_level_set_thresholds(&thresholds) == -EINVAL) {
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    return len;
+}
+
+static ssize_t bluetooth_flow_rate_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                        void* buf, uint16_t len, uint16_t offset) {
+    const int32_t flow_rate = trend_get_flow_rate();
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &flow_rate, sizeof(flow_rate));
+}
+
+static ssize_t bluetooth_leak_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                   void* buf, uint16_t len, uint16_t offset) {
+    const uint8_t leak = trend_get_leak();
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &leak, sizeof(leak));
+}
+
+static ssize_t bluetooth_history_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      void* buf, uint16_t len, uint16_t offset) {
+    int read = history_read(offset, buf, len);
+    if (read == -EAGAIN) {
+        return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    } else if (read < 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+    return read;
+}
+
+static ssize_t bluetooth_history_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                       const void* buf, uint16_t len, uint16_t offset,
+                                       uint8_t flags) {
+    uint32_t seq = 0;
+
+    if (offset != 0 || len != sizeof(seq)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    // FIXME: the selection is shared between connections, which is fine as
+    //  long as only one base station downloads the history at a time.
+    memcpy(&seq, buf, len);
+    history_select(seq);
+
+    return len;
+}
+
 static ssize_t bluetooth_error_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
                                     void* buf, uint16_t len, uint16_t offset) {
     return bt_gatt_attr_read(conn, attr, buf, len, offset, &error, sizeof(error));
@@ -340,36 +975,16 @@ static ssize_t bluetooth_error_write(struct bt_conn* conn, const struct bt_gatt_
     return len;
 }
 
-static void bluetooth_status_update() {
-    // Update the advertising and service data
-    bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
-
-    if (*status & STATUS_NEW_DATA) {
-        // If there is new data, start advertising
-        int err;
-        IF_ERR(bluetooth_advertising_start()) {
-            if (err == -EALREADY) {
-                LOG_DBG("Advertising already started");
-            } else {
-                LOG_ERR("Advertising failed to restart (err %d)", err);
-            }
-        }
-    } else if (bluetooth_get_conn_count() == 0) {
-        // If there is no longer new data and no one is connected, stop advertising
-        bt_le_adv_stop();
-        LOG_DBG("Stopped advertising, no clients connected");
-    }
-}
-
 static ssize_t bluetooth_status_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
                                      void* buf, uint16_t len, uint16_t offset) {
-    return bt_gatt_attr_read(conn, attr, buf, len, offset, status, sizeof(*status));
+    const uint32_t value = atomic_get(&status);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &value, sizeof(value));
 }
 
 static ssize_t bluetooth_status_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
                                       const void* buf, uint16_t len, uint16_t offset,
                                       uint8_t flags) {
-    if (offset + len > sizeof(*status)) {
+    if (offset + len > sizeof(uint32_t)) {
         return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
     }
 
@@ -379,12 +994,18 @@ static ssize_t bluetooth_status_write(struct bt_conn* conn, const struct bt_gatt
     memset(((uint8_t*)&mask_write) + offset, 0xff, len);
 
     // Only set bits specified by the write mask
-    // FIXME: this is cheating because we don't use atomic operations. It
-    //  should be fine though because this function is called from a
-    //  cooperative thread.
-    *status = (*status & ~mask_write) | status_write;
+    mask_write &= STATUS_WRITABLE;
+    atomic_val_t old;
+    do {
+        old = atomic_get(&status);
+    } while (!atomic_cas(&status, old, (old & ~mask_write) | (status_write & mask_write)));
+
+    // Clearing the new data bit is the last step of a data pull
+    if ((mask_write & STATUS_NEW_DATA) && !(status_write & STATUS_NEW_DATA)) {
+        bluetooth_conn_collected(conn);
+    }
 
-    bluetooth_status_update();
+    bluetooth_adv_request(ADV_EVENT_STATUS);
 
     return len;
 }
@@ -395,18 +1016,241 @@ static ssize_t bluetooth_battery_voltage_read(struct bt_conn* conn, const struct
     return bt_gatt_attr_read(conn, attr, buf, len, offset, &voltage, sizeof(voltage));
 }
 
-int bluetooth_init(void) { return bt_enable(bluetooth_ready); }
+static ssize_t bluetooth_period_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset) {
+    uint32_t period[3] = {schedule_get_period()};
+    schedule_get_bounds(&period[1], &period[2]);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, period, sizeof(period));
+}
+
+static ssize_t bluetooth_period_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      const void* buf, uint16_t len, uint16_t offset,
+                                      uint8_t flags) {
+    // Only the bounds can be written
+    uint32_t bounds[2];
+
+    if (offset != 0 || len != sizeof(bounds)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    memcpy(bounds, buf, len);
+    if (schedule_set_bounds(bounds[0], bounds[1]) == -EINVAL) {
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    return len;
+}
+
+#define SNAPSHOT_VERSION 1
+
+// Values of all the individual characteristics, ordered so every field is
+// naturally aligned. Fields are only ever appended, along with a version bump.
+struct bluetooth_snapshot {
+    uint8_t version;
+    uint8_t battery_level;  // %
+    uint8_t pings;
+    uint8_t samples;
+    uint32_t status;
+    uint32_t errors;
+    int32_t flow_rate;  // 0.01 mm/h
+    uint32_t period;  // s
+    uint16_t water_level;  // mm
+    uint16_t water_distance;  // mm
+    uint16_t tank_depth;  // mm
+    int16_t temperature;  // 0.01 C
+    uint16_t battery_voltage;  // mV
+} __packed;
+
+static void bluetooth_snapshot_get(struct bluetooth_snapshot* snapshot) {
+    *snapshot = (struct bluetooth_snapshot){
+        .version = SNAPSHOT_VERSION,
+        .battery_level = battery_get_level(),
+        .pings = water_level_get_pings(),
+        .samples = water_level_get_samples(),
+        .status = atomic_get(&status),
+        .errors = atomic_get(&error),
+        .flow_rate = trend_get_flow_rate(),
+        .period = schedule_get_period(),
+        .water_level = water_level_get(),
+        .water_distance = water_level_get_water_distance(),
+        .tank_depth = water_level_get_tank_depth(),
+        .temperature = (int16_t)temperature_get(),
+        .battery_voltage = battery_get_voltage(),
+    };
+}
+
+// Runtime configuration, read and written as a whole
+struct bluetooth_config {
+    struct water_level_config water_level;
+    // Update period bounds in s
+    uint32_t period_min;
+    uint32_t period_max;
+} __packed;
+
+static ssize_t bluetooth_config_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset) {
+    struct bluetooth_config config;
+    uint32_t min, max;
+
+    water_level_get_config(&config.water_level);
+    schedule_get_bounds(&min, &max);
+    config.period_min = min;
+    config.period_max = max;
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &config, sizeof(config));
+}
+
+static ssize_t bluetooth_config_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                      const void* buf, uint16_t len, uint16_t offset,
+                                      uint8_t flags) {
+    struct bluetooth_config config;
+    uint32_t old_min, old_max;
+
+    if (offset != 0 || len != sizeof(config)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    memcpy(&config, buf, len);
+    schedule_get_bounds(&old_min, &old_max);
+    if (schedule_set_bounds(config.period_min, config.period_max) == -EINVAL) {
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+    if (water_level_set_config(&config.water_level) == -EINVAL) {
+        // Apply all or nothing
+        schedule_set_bounds(old_min, old_max);
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    return len;
+}
+
+static ssize_t bluetooth_snapshot_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                       void* buf, uint16_t len, uint16_t offset) {
+    // The snapshot does not fit in the default MTU if the client does not
+    // exchange MTUs. Take it at the start of a long read so all parts come
+    // from the same measurement.
+    static struct bluetooth_snapshot snapshot;
+
+    if (offset == 0) {
+        bluetooth_snapshot_get(&snapshot);
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &snapshot, sizeof(snapshot));
+}
+
+static ssize_t bluetooth_adv_stats_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                        void* buf, uint16_t len, uint16_t offset) {
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &adv_stats, sizeof(adv_stats));
+}
+
+static ssize_t bluetooth_conn_stats_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                         void* buf, uint16_t len, uint16_t offset) {
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &conn_stats, sizeof(conn_stats));
+}
+
+static ssize_t bluetooth_energy_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset) {
+    struct energy_report report;
+    energy_get_report(&report);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &report, sizeof(report));
+}
+
+static ssize_t bluetooth_timing_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     void* buf, uint16_t len, uint16_t offset) {
+    struct pipeline_timing timing;
+    pipeline_get_timing(&timing);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &timing, sizeof(timing));
+}
+
+static ssize_t bluetooth_crash_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                    void* buf, uint16_t len, uint16_t offset) {
+    struct crash_record record;
+    crash_get(&record);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &record, sizeof(record));
+}
+
+static ssize_t bluetooth_crash_write(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                     const void* buf, uint16_t len, uint16_t offset,
+                                     uint8_t flags) {
+    if (offset != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+    if (len != 1) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+    if (*(const uint8_t*)buf != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    crash_clear();
+
+    return len;
+}
+
+static ssize_t bluetooth_watchdog_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                       void* buf, uint16_t len, uint16_t offset) {
+    struct watchdog_report report;
+    watchdog_get_report(&report);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &report, sizeof(report));
+}
+
+int bluetooth_init(void) {
+    for (size_t i = 0; i < ARRAY_SIZE(conns); ++i) {
+        k_work_init_delayable(&conns[i].idle_work, bluetooth_conn_idle);
+    }
+
+    return bt_enable(bluetooth_ready);
+}
 
 void bluetooth_set_error(enum system_error e) { atomic_or(&error, e); }
 
 bool bluetooth_get_error(enum system_error e) { return atomic_get(&error) & e; }
 
+void bluetooth_alert(void) {
+    if (bluetooth_get_subscribed_count() > 0) {
+        LOG_DBG("Not advertising alert, subscribers will be notified");
+        return;
+    }
+
+    bluetooth_adv_request(ADV_EVENT_ALERT);
+}
+
+#ifdef CONFIG_BLUETOOTH_BROADCAST
+static void bluetooth_broadcast_end(struct k_work* work) {
+    // Stop advertising the measurement if no client connected to collect it
+    if (atomic_get(&status) & STATUS_NEW_DATA) {
+        LOG_DBG("Broadcast ended without a client clearing new data");
+        bluetooth_set_status(STATUS_NEW_DATA, false);
+    }
+}
+#endif
+
+void bluetooth_broadcast(void) {
+    int err;
+
+    if (bluetooth_get_subscribed_count() > 0) {
+        struct bluetooth_snapshot snapshot;
+        bluetooth_snapshot_get(&snapshot);
+        IF_ERR(bt_gatt_notify(NULL, bluetooth_snapshot_attr(), &snapshot, sizeof(snapshot))) {
+            LOG_WRN("Failed to notify snapshot (err %d)", err);
+        } else {
+            // Subscribers already have the data, so there is nothing to
+            // advertise
+            return;
+        }
+    }
+
+    // The measurements are copied into the advertising data by
+    // adv_update_work
+    atomic_or(&status, STATUS_NEW_DATA);
+    bluetooth_adv_request(ADV_EVENT_BROADCAST);
+}
+
 void bluetooth_set_status(enum system_status s, bool value) {
     if (value) {
-        *status |= s;
+        atomic_or(&status, s);
     } else {
-        *status &= ~s;
+        atomic_and(&status, ~s);
     }
 
-    bluetooth_status_update();
+    bluetooth_adv_request(ADV_EVENT_STATUS);
 }
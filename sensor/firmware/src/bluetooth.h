@@ -13,6 +13,12 @@ enum system_error {
 
 enum system_status {
     STATUS_NEW_DATA = BIT(0),
+    // Water level is outside the configured thresholds
+    STATUS_ALERT = BIT(1),
+    // Water level has been dropping at a leak rate for several updates
+    STATUS_LEAK = BIT(2),
+    // Battery is low and the sensor measures less often or not at all
+    STATUS_LOW_POWER = BIT(3),
 };
 
 int bluetooth_init(void);
@@ -32,8 +38,23 @@ void bluetooth_set_error(enum system_error e);
 bool bluetooth_get_error(enum system_error e);
 
 /**
- * Set the value of a status bit.
+ * Set the value of a status bit. Can be called from any thread, advertising
+ * is updated afterwards on the system work queue.
  * @param s status bit to set
  * @param value value of the bit
  */
 void bluetooth_set_status(enum system_status s, bool value);
+
+/**
+ * Announce that new measurements are available. Subscribed clients are
+ * notified directly, otherwise the sensor advertises until a client clears the
+ * new data status bit. With broadcast mode enabled, the measurements are also
+ * put in the advertising data for a while.
+ */
+void bluetooth_broadcast(void);
+
+/**
+ * Advertise quickly for a while, so an alert reaches the base station without
+ * waiting for the slow advertising interval. Can be called from any thread.
+ */
+void bluetooth_alert(void);
\ No newline at end of file
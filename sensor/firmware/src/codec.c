@@ -0,0 +1,132 @@
+#include "codec.h"
+
+#include <stdbool.h>
+
+struct codec_writer {
+    uint8_t* buf;
+    size_t len;
+    size_t pos;
+    bool overflow;
+};
+
+struct codec_reader {
+    const uint8_t* buf;
+    size_t len;
+    size_t pos;
+    bool truncated;
+};
+
+static inline uint32_t codec_zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t codec_unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static void codec_put(struct codec_writer* w, uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0) byte |= 0x80;
+
+        if (w->pos == w->len) {
+            w->overflow = true;
+            return;
+        }
+        w->buf[w->pos++] = byte;
+    } while (value != 0);
+}
+
+static inline void codec_put_signed(struct codec_writer* w, int32_t value) {
+    codec_put(w, codec_zigzag(value));
+}
+
+static uint32_t codec_get(struct codec_reader* r) {
+    uint32_t value = 0;
+    for (unsigned int shift = 0; shift < 32; shift += 7) {
+        if (r->pos == r->len) {
+            r->truncated = true;
+            return 0;
+        }
+        const uint8_t byte = r->buf[r->pos++];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    // Too many continuation bytes
+    r->truncated = true;
+    return 0;
+}
+
+static inline int32_t codec_get_signed(struct codec_reader* r) {
+    return codec_unzigzag(codec_get(r));
+}
+
+size_t codec_encode_key(const struct codec_state* state, uint8_t* buf, size_t len) {
+    struct codec_writer w = {.buf = buf, .len = len};
+    const struct history_entry* e = &state->last;
+
+    codec_put(&w, e->seq);
+    codec_put_signed(&w, e->record.time);
+    codec_put_signed(&w, state->interval);
+    codec_put(&w, e->record.water_level);
+    codec_put(&w, e->record.water_distance);
+    codec_put_signed(&w, e->record.temperature);
+    codec_put(&w, e->record.voltage);
+
+    return w.overflow ? 0 : w.pos;
+}
+
+size_t codec_decode_key(struct codec_state* state, const uint8_t* buf, size_t len) {
+    struct codec_reader r = {.buf = buf, .len = len};
+    struct codec_state s;
+
+    s.last.seq = codec_get(&r);
+    s.last.record.time = codec_get_signed(&r);
+    s.interval = codec_get_signed(&r);
+    s.last.record.water_level = codec_get(&r);
+    s.last.record.water_distance = codec_get(&r);
+    s.last.record.temperature = codec_get_signed(&r);
+    s.last.record.voltage = codec_get(&r);
+
+    if (r.truncated) return 0;
+    *state = s;
+    return r.pos;
+}
+
+size_t codec_encode(struct codec_state* state, const struct history_entry* entry, uint8_t* buf,
+                    size_t len) {
+    struct codec_writer w = {.buf = buf, .len = len};
+    const struct history_entry* last = &state->last;
+    // Wrapping arithmetic, so any difference round trips
+    const int32_t interval = (int32_t)((uint32_t)entry->record.time - (uint32_t)last->record.time);
+
+    codec_put(&w, entry->seq - last->seq - 1);
+    codec_put_signed(&w, (int32_t)((uint32_t)interval - (uint32_t)state->interval));
+    codec_put_signed(&w, (int32_t)entry->record.water_level - last->record.water_level);
+    codec_put_signed(&w, (int32_t)entry->record.water_distance - last->record.water_distance);
+    codec_put_signed(&w, (int32_t)entry->record.temperature - last->record.temperature);
+    codec_put_signed(&w, (int32_t)entry->record.voltage - last->record.voltage);
+
+    if (w.overflow) return 0;
+    state->last = *entry;
+    state->interval = interval;
+    return w.pos;
+}
+
+size_t codec_decode(struct codec_state* state, const uint8_t* buf, size_t len) {
+    struct codec_reader r = {.buf = buf, .len = len};
+    struct codec_state s = *state;
+
+    s.last.seq += codec_get(&r) + 1;
+    s.interval = (int32_t)((uint32_t)s.interval + (uint32_t)codec_get_signed(&r));
+    s.last.record.time = (int32_t)((uint32_t)s.last.record.time + (uint32_t)s.interval);
+    s.last.record.water_level += codec_get_signed(&r);
+    s.last.record.water_distance += codec_get_signed(&r);
+    s.last.record.temperature += codec_get_signed(&r);
+    s.last.record.voltage += codec_get_signed(&r);
+
+    if (r.truncated) return 0;
+    *state = s;
+    return r.pos;
+}
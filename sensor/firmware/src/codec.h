@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "history.h"
+
+/*
+ * Compact encoding for a stream of history entries.
+ *
+ * A stream starts with a key, which holds the first entry in full along with
+ * the time between it and the entry before it. Every following entry is
+ * encoded relative to the one before: the sequence number as an unsigned
+ * varint of the gap (0 for consecutive entries), the time as a zig-zag varint
+ * of the change in the time between entries, and the remaining fields as
+ * zig-zag varints of their change. With a regular update period and slowly
+ * changing values, most entries take 6-7 bytes.
+ *
+ * A stream can be shortened from the front by decoding up to the new first
+ * entry and replacing everything before it with codec_encode_key().
+ */
+
+// Largest possible encoding of a key or an entry
+#define CODEC_MAX_LEN 27
+
+/**
+ * Entry most recently encoded or decoded, and the information needed to
+ * encode or decode the entry that follows it.
+ */
+struct codec_state {
+    struct history_entry last;
+    // Time between the last entry and the one before it
+    int32_t interval;
+};
+
+/**
+ * Encode a key representing the entry held by state.
+ *
+ * @return number of bytes written, or 0 if buf is too small
+ */
+size_t codec_encode_key(const struct codec_state* state, uint8_t* buf, size_t len);
+
+/**
+ * Decode a key into state.
+ *
+ * @return number of bytes read, or 0 if the key is truncated
+ */
+size_t codec_decode_key(struct codec_state* state, const uint8_t* buf, size_t len);
+
+/**
+ * Encode entry relative to the entry held by state, then update state to hold
+ * it. entry->seq must be greater than the sequence number of the last entry.
+ *
+ * @return number of bytes written, or 0 if buf is too small, in which case
+ *         state is unchanged
+ */
+size_t codec_encode(struct codec_state* state, const struct history_entry* entry, uint8_t* buf,
+                    size_t len);
+
+/**
+ * Decode the entry following the one held by state, then update state to hold
+ * it.
+ *
+ * @return number of bytes read, or 0 if the entry is truncated, in which case
+ *         state is unchanged
+ */
+size_t codec_decode(struct codec_state* state, const uint8_t* buf, size_t len);
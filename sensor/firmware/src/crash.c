@@ -0,0 +1,81 @@
+#include "crash.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+
+LOG_MODULE_REGISTER(crash);
+
+// Kept in RAM that is not cleared at boot, like the energy counters
+static __noinit struct {
+    struct crash_record record;
+    uint32_t crc;
+} crash;
+
+static struct k_spinlock lock;
+
+static uint32_t crash_crc(void) {
+    return crc32_ieee((const uint8_t*)&crash.record, sizeof(crash.record));
+}
+
+int crash_init(void) {
+    K_SPINLOCK(&lock) {
+        if (crash.crc != crash_crc()) {
+            memset(&crash, 0, sizeof(crash));
+        } else if (crash.record.resets < UINT16_MAX) {
+            ++crash.record.resets;
+        }
+        crash.crc = crash_crc();
+    }
+
+    if (crash.record.crashes > 0) {
+        LOG_WRN("Last crash: reason %u at PC 0x%08x, LR 0x%08x in %.*s after %u ms",
+                crash.record.reason,
+                crash.record.pc,
+                crash.record.lr,
+                CRASH_THREAD_NAME_LEN,
+                crash.record.thread,
+                crash.record.uptime);
+    }
+
+    return 0;
+}
+
+void crash_save(unsigned int reason, const struct arch_esf* esf) {
+    // Called with the system in an unknown state, so don't take the lock.
+    // Interrupts are already locked by the fatal error path.
+    struct crash_record* r = &crash.record;
+
+    if (r->crashes < UINT16_MAX) {
+        ++r->crashes;
+    }
+    r->reason = reason;
+    r->pc = esf != NULL ? esf->basic.pc : 0;
+    r->lr = esf != NULL ? esf->basic.lr : 0;
+    r->uptime = (uint32_t)k_uptime_get();
+
+    memset(r->thread, 0, sizeof(r->thread));
+#ifdef CONFIG_THREAD_NAME
+    const char* name = k_thread_name_get(k_current_get());
+    if (name != NULL) {
+        strncpy(r->thread, name, sizeof(r->thread));
+    }
+#endif
+
+    crash.crc = crash_crc();
+}
+
+void crash_get(struct crash_record* record) {
+    K_SPINLOCK(&lock) { *record = crash.record; }
+}
+
+void crash_clear(void) {
+    K_SPINLOCK(&lock) {
+        const uint16_t resets = crash.record.resets;
+        memset(&crash.record, 0, sizeof(crash.record));
+        crash.record.resets = resets;
+        crash.crc = crash_crc();
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <zephyr/arch/cpu.h>
+#include <zephyr/toolchain.h>
+
+#define CRASH_THREAD_NAME_LEN 8
+
+/**
+ * Record of the last fatal error, kept across warm resets.
+ */
+struct crash_record {
+    // Warm resets since the last power-on reset
+    uint16_t resets;
+    // Fatal errors since the record was last cleared. The fields below are
+    // only valid if this is not 0.
+    uint16_t crashes;
+    // K_ERR_* reason passed to the fatal error handler
+    uint32_t reason;
+    // Program counter and link register at the fault, or 0 if unknown
+    uint32_t pc;
+    uint32_t lr;
+    // Time since boot in ms
+    uint32_t uptime;
+    // Name of the faulting thread, not terminated if it fills the field
+    char thread[CRASH_THREAD_NAME_LEN];
+} __packed;
+
+/**
+ * Restore the record kept across warm resets and count the reset, or clear
+ * the record if it was lost.
+ */
+int crash_init(void);
+
+/**
+ * Record a fatal error. Safe to call from the fatal error handler.
+ *
+ * @param esf exception stack frame, may be NULL
+ */
+void crash_save(unsigned int reason, const struct arch_esf* esf);
+
+void crash_get(struct crash_record* record);
+
+/**
+ * Clear the last fatal error, keeping the reset counter.
+ */
+void crash_clear(void);
@@ -0,0 +1,114 @@
+#include "energy.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+
+LOG_MODULE_REGISTER(energy);
+
+#define ENERGY_MODEL DT_NODELABEL(energy_model)
+
+// uA * ms = nC, and 1 uAh = 3.6 C
+#define NC_PER_UAH 3600000
+
+// Kept in RAM that is not cleared at boot, so the counters survive warm
+// resets. The CRC tells them apart from the garbage left by a power-on reset.
+struct energy_counters {
+    uint64_t time[ENERGY_STATE_COUNT];  // ms
+    uint32_t events[ENERGY_EVENT_COUNT];
+    uint32_t crc;
+};
+
+static __noinit struct energy_counters counters;
+
+static struct k_spinlock lock;
+
+// Kernel CPU time counters at the last update, which restart at boot
+static uint64_t last_active_cycles;
+static uint64_t last_idle_cycles;
+
+static uint32_t energy_crc(void) {
+    return crc32_ieee((const uint8_t*)&counters, offsetof(struct energy_counters, crc));
+}
+
+int energy_init(void) {
+    if (counters.crc != energy_crc()) {
+        LOG_INF("Energy counters lost, clearing");
+        memset(&counters, 0, sizeof(counters));
+        counters.crc = energy_crc();
+    }
+
+    return 0;
+}
+
+void energy_add_time(enum energy_state state, uint32_t ms) {
+    K_SPINLOCK(&lock) {
+        counters.time[state] += ms;
+        counters.crc = energy_crc();
+    }
+}
+
+void energy_add_events(enum energy_event event, uint32_t count) {
+    K_SPINLOCK(&lock) {
+        counters.events[event] += count;
+        counters.crc = energy_crc();
+    }
+}
+
+/**
+ * Convert the cycles counted since the last update to ms, keeping the
+ * remainder for the next update.
+ */
+static uint64_t energy_cycles_to_ms(uint64_t cycles, uint64_t* last) {
+    const uint64_t ms = k_cyc_to_ms_floor64(cycles - *last);
+    *last += k_ms_to_cyc_floor64(ms);
+    return ms;
+}
+
+void energy_update(void) {
+    k_thread_runtime_stats_t stats;
+
+    if (k_thread_runtime_stats_all_get(&stats) < 0) return;
+
+    K_SPINLOCK(&lock) {
+        counters.time[ENERGY_CPU_ACTIVE] +=
+            energy_cycles_to_ms(stats.total_cycles, &last_active_cycles);
+        counters.time[ENERGY_CPU_IDLE] += energy_cycles_to_ms(stats.idle_cycles, &last_idle_cycles);
+        counters.crc = energy_crc();
+    }
+}
+
+void energy_get_report(struct energy_report* report) {
+    struct energy_counters c;
+
+    energy_update();
+    K_SPINLOCK(&lock) { c = counters; }
+
+    for (size_t i = 0; i < ENERGY_STATE_COUNT; ++i) {
+        report->time[i] = c.time[i] / MSEC_PER_SEC;
+    }
+    for (size_t i = 0; i < ENERGY_EVENT_COUNT; ++i) {
+        report->events[i] = c.events[i];
+    }
+
+    // Charge in nC
+    uint64_t charge[ENERGY_SUBSYSTEM_COUNT] = {
+        [ENERGY_SUBSYSTEM_RANGEFINDER] =
+            c.time[ENERGY_RANGEFINDER] * DT_PROP(ENERGY_MODEL, rangefinder_microamp) +
+            (uint64_t)c.events[ENERGY_PING] * DT_PROP(ENERGY_MODEL, ping_nanocoulomb),
+        [ENERGY_SUBSYSTEM_ADC] =
+            (uint64_t)c.events[ENERGY_ADC_SAMPLE] * DT_PROP(ENERGY_MODEL, adc_sample_nanocoulomb),
+        [ENERGY_SUBSYSTEM_RADIO] =
+            (uint64_t)c.events[ENERGY_ADV_EVENT] * DT_PROP(ENERGY_MODEL, adv_event_nanocoulomb) +
+            c.time[ENERGY_CONNECTED] * DT_PROP(ENERGY_MODEL, connected_microamp),
+        [ENERGY_SUBSYSTEM_CPU] =
+            c.time[ENERGY_CPU_ACTIVE] * DT_PROP(ENERGY_MODEL, cpu_active_microamp) +
+            c.time[ENERGY_CPU_IDLE] * DT_PROP(ENERGY_MODEL, cpu_idle_microamp),
+    };
+    for (size_t i = 0; i < ENERGY_SUBSYSTEM_COUNT; ++i) {
+        report->charge[i] = charge[i] / NC_PER_UAH;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+enum energy_state {
+    // Rangefinder supply switched on
+    ENERGY_RANGEFINDER,
+    ENERGY_ADVERTISING,
+    // Summed over all connections
+    ENERGY_CONNECTED,
+    // Measured by the kernel, not passed to energy_add_time()
+    ENERGY_CPU_ACTIVE,
+    ENERGY_CPU_IDLE,
+    ENERGY_STATE_COUNT,
+};
+
+enum energy_event {
+    ENERGY_PING,
+    ENERGY_ADC_SAMPLE,
+    ENERGY_ADV_EVENT,
+    ENERGY_EVENT_COUNT,
+};
+
+enum energy_subsystem {
+    ENERGY_SUBSYSTEM_RANGEFINDER,
+    ENERGY_SUBSYSTEM_ADC,
+    ENERGY_SUBSYSTEM_RADIO,
+    ENERGY_SUBSYSTEM_CPU,
+    ENERGY_SUBSYSTEM_COUNT,
+};
+
+/**
+ * Energy counters since the last power-on reset, and the charge drawn by each
+ * subsystem estimated from them with the current figures in the devicetree
+ * energy model.
+ */
+struct energy_report {
+    // Time spent in each state in s
+    uint32_t time[ENERGY_STATE_COUNT];
+    uint32_t events[ENERGY_EVENT_COUNT];
+    // Estimated charge in uAh
+    uint32_t charge[ENERGY_SUBSYSTEM_COUNT];
+} __packed;
+
+/**
+ * Restore the counters kept across warm resets, or clear them if they were
+ * lost.
+ */
+int energy_init(void);
+
+/**
+ * Add time spent in a state.
+ *
+ * @param ms time in milliseconds
+ */
+void energy_add_time(enum energy_state state, uint32_t ms);
+
+void energy_add_events(enum energy_event event, uint32_t count);
+
+/**
+ * Add the CPU time since the last update. Called once per update so the
+ * counters stay current across resets.
+ */
+void energy_update(void);
+
+void energy_get_report(struct energy_report* report);
@@ -0,0 +1,114 @@
+#include "filter.h"
+
+#include <zephyr/sys/__assert.h>
+#include <zephyr/sys/util.h>
+
+static inline void filter_swap(uint32_t* a, uint32_t* b) {
+    uint32_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+uint32_t filter_select(uint32_t* values, size_t count, size_t k) {
+    __ASSERT_NO_MSG(k < count);
+
+    // Quickselect with median of three pivot, iterating into the side that
+    // contains k
+    size_t left = 0;
+    size_t right = count - 1;
+    while (left < right) {
+        size_t mid = left + (right - left) / 2;
+        if (values[mid] < values[left]) filter_swap(&values[mid], &values[left]);
+        if (values[right] < values[left]) filter_swap(&values[right], &values[left]);
+        if (values[right] < values[mid]) filter_swap(&values[right], &values[mid]);
+        const uint32_t pivot = values[mid];
+
+        size_t i = left;
+        size_t j = right;
+        while (i <= j) {
+            while (values[i] < pivot) ++i;
+            while (values[j] > pivot) --j;
+            if (i <= j) {
+                filter_swap(&values[i], &values[j]);
+                ++i;
+                // j can't underflow: values[left] <= pivot stops the scan above
+                if (j == 0) break;
+                --j;
+            }
+        }
+
+        if (k <= j) {
+            right = j;
+        } else if (k >= i) {
+            left = i;
+        } else {
+            break;
+        }
+    }
+    return values[k];
+}
+
+static uint32_t filter_max(const uint32_t* values, size_t count) {
+    uint32_t max = values[0];
+    for (size_t i = 1; i < count; ++i) {
+        max = MAX(max, values[i]);
+    }
+    return max;
+}
+
+uint32_t filter_median(uint32_t* values, size_t count) {
+    __ASSERT_NO_MSG(count > 0);
+
+    const uint32_t upper = filter_select(values, count, count / 2);
+    if (count % 2 != 0) {
+        // Odd number of samples, single median value
+        return upper;
+    }
+    // Even number of samples, average middle two. The lower one is the
+    // largest value of the lower half left by the selection.
+    const uint32_t lower = filter_max(values, count / 2);
+    return lower + DIV_ROUND_CLOSEST(upper - lower, 2);
+}
+
+uint32_t filter_trimmed_mean(uint32_t* values, size_t count, size_t trim) {
+    __ASSERT_NO_MSG(count > 2 * trim);
+
+    if (trim > 0) {
+        // Move the smallest values to the start, then the largest of the
+        // remainder to the end
+        filter_select(values, count, trim - 1);
+        filter_select(values + trim, count - trim, count - 2 * trim);
+    }
+
+    uint64_t sum = 0;
+    for (size_t i = trim; i < count - trim; ++i) {
+        sum += values[i];
+    }
+    const size_t n = count - 2 * trim;
+    return (uint32_t)((sum + n / 2) / n);
+}
+
+uint32_t filter_mad_mean(uint32_t* values, uint32_t* scratch, size_t count,
+                         uint32_t threshold_tenths) {
+    const uint32_t median = filter_median(values, count);
+
+    for (size_t i = 0; i < count; ++i) {
+        scratch[i] = values[i] > median ? values[i] - median : median - values[i];
+    }
+    const uint64_t mad = filter_median(scratch, count);
+    const uint64_t limit = mad * threshold_tenths;
+
+    uint64_t sum = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t deviation = values[i] > median ? values[i] - median : median - values[i];
+        if ((uint64_t)deviation * 10 <= limit) {
+            sum += values[i];
+            ++n;
+        }
+    }
+    // The median itself is always within the limit, except when rounding an
+    // even median lands between two samples and the MAD is 0
+    if (n == 0) return median;
+    return (uint32_t)((sum + n / 2) / n);
+}
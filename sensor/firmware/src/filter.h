@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocation-free estimators for small sample sets. All functions reorder the
+ * values in place and require count > 0.
+ */
+
+/**
+ * Select the k-th smallest value. Afterwards, values[k] holds that value, all
+ * values before it are no larger and all values after it are no smaller.
+ *
+ * @param values values to select from
+ * @param count number of values
+ * @param k index of the value to select (0-based, < count)
+ * @return k-th smallest value
+ */
+uint32_t filter_select(uint32_t* values, size_t count, size_t k);
+
+/**
+ * Get the median, averaging the middle two values of an even count.
+ */
+uint32_t filter_median(uint32_t* values, size_t count);
+
+/**
+ * Get the mean after discarding the smallest and largest values.
+ *
+ * @param trim number of values to discard from each end, must leave at least
+ *             one value
+ */
+uint32_t filter_trimmed_mean(uint32_t* values, size_t count, size_t trim);
+
+/**
+ * Get the mean of the values within a multiple of the median absolute
+ * deviation (MAD) of the median.
+ *
+ * @param scratch buffer of count values
+ * @param threshold_tenths maximum distance from the median, in tenths of a
+ *                         MAD
+ */
+uint32_t filter_mad_mean(uint32_t* values, uint32_t* scratch, size_t count,
+                         uint32_t threshold_tenths);
@@ -0,0 +1,360 @@
+#include "history.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/random.h>
+#include <zephyr/settings/settings.h>
+
+#include "battery.h"
+#include "codec.h"
+#include "common.h"
+#include "temperature.h"
+#include "water_level.h"
+
+LOG_MODULE_REGISTER(history);
+
+// Largest value of a characteristic that can be read with a long read
+#define HISTORY_MAX_READ_LEN 512
+
+// Format of the history as committed to flash
+struct history_store {
+    // Uptime when the history was committed, in seconds
+    uint32_t uptime;
+    // Sequence numbering the stream belongs to, see history_header.epoch
+    uint32_t epoch;
+    // Codec stream, oldest entry first
+    uint8_t data[CONFIG_HISTORY_BUFFER_SIZE];
+} __packed;
+
+K_MUTEX_DEFINE(history_lock);
+
+static struct {
+    struct history_store store;
+    // Length of the stream in store.data
+    size_t len;
+    size_t count;
+    // State after the newest entry, used to append to the stream
+    struct codec_state tail;
+    uint32_t next_seq;
+    // Sequence numbering in use, or 0 until it is restored or picked
+    uint32_t epoch;
+    // Records added since the last commit
+    size_t uncommitted;
+
+    // Records selected by history_select()
+    uint32_t select_seq;
+    struct history_header select_header;
+    bool select_found;
+    // Sequence number of the first selected entry
+    uint32_t select_first;
+    // Length of the stream following the first selected entry
+    size_t select_len;
+} state;
+
+/**
+ * Decode the stream up to the oldest entry with a sequence number of at least
+ * seq.
+ *
+ * @param s filled in with the state holding the entry
+ * @param end filled in with the offset of the stream following the entry
+ * @return true if the entry was found
+ */
+static bool history_find(uint32_t seq, struct codec_state* s, size_t* end) {
+    if (state.count == 0) return false;
+
+    size_t pos = codec_decode_key(s, state.store.data, state.len);
+    for (size_t i = 1; s->last.seq < seq; ++i) {
+        if (i == state.count) return false;
+        pos += codec_decode(s, state.store.data + pos, state.len - pos);
+    }
+
+    *end = pos;
+    return true;
+}
+
+/**
+ * Walk the whole stream to count the entries and find the state after the
+ * newest.
+ *
+ * @return 0 on success, -EINVAL if the stream is corrupt
+ */
+static int history_scan(void) {
+    state.count = 0;
+    if (state.len == 0) return 0;
+
+    size_t pos = codec_decode_key(&state.tail, state.store.data, state.len);
+    if (pos == 0) return -EINVAL;
+    state.count = 1;
+
+    while (pos < state.len) {
+        size_t n = codec_decode(&state.tail, state.store.data + pos, state.len - pos);
+        if (n == 0) return -EINVAL;
+        pos += n;
+        ++state.count;
+    }
+
+    return 0;
+}
+
+/**
+ * Drop the oldest entry by replacing it and the entry after it with a key
+ * for the latter. May drop more than one entry if the new key would not fit.
+ */
+static void history_drop_oldest(void) {
+    struct codec_state s;
+    size_t pos = codec_decode_key(&s, state.store.data, state.len);
+
+    for (size_t dropped = 1; dropped < state.count; ++dropped) {
+        pos += codec_decode(&s, state.store.data + pos, state.len - pos);
+
+        uint8_t key[CODEC_MAX_LEN];
+        const size_t key_len = codec_encode_key(&s, key, sizeof(key));
+        if (key_len + (state.len - pos) <= sizeof(state.store.data)) {
+            memmove(state.store.data + key_len, state.store.data + pos, state.len - pos);
+            memcpy(state.store.data, key, key_len);
+            state.len = key_len + (state.len - pos);
+            state.count -= dropped;
+            return;
+        }
+    }
+
+    state.len = 0;
+    state.count = 0;
+}
+
+/**
+ * Get the sequence numbering in use, picking a new one if the history was not
+ * restored. Must be called with the lock held.
+ */
+static uint32_t history_epoch(void) {
+    while (state.epoch == 0) {
+        state.epoch = sys_rand32_get();
+    }
+    return state.epoch;
+}
+
+static int history_settings_set(const char* key, size_t len_rd, settings_read_cb read_cb,
+                                void* cb_arg) {
+    int len = settings_name_next(key, NULL);
+    if (strncmp(key, "store", len)) {
+        return -ENOENT;
+    }
+
+    if (len_rd < offsetof(struct history_store, data) || len_rd > sizeof(state.store)) {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&history_lock, K_FOREVER);
+
+    int err = 0;
+    if (state.count > 0) {
+        // Settings are loaded asynchronously after Bluetooth is ready, so a
+        // measurement could have been recorded already
+        LOG_WRN("History already in use, not restoring");
+        goto out;
+    }
+
+    IF_ERR(read_cb(cb_arg, &state.store, len_rd)) { goto out; }
+    state.len = len_rd - offsetof(struct history_store, data);
+    if (state.len == 0) {
+        goto out;
+    }
+
+    // The time the device was off for is unknown, so assume the reset
+    // happened right after the commit and express the restored timestamps
+    // relative to this boot. Only the key holds an absolute time.
+    struct codec_state s;
+    uint8_t new_key[CODEC_MAX_LEN];
+    const size_t old_key_len = codec_decode_key(&s, state.store.data, state.len);
+    s.last.record.time -= (int32_t)state.store.uptime;
+    const size_t new_key_len = codec_encode_key(&s, new_key, sizeof(new_key));
+    if (old_key_len == 0 || new_key_len + (state.len - old_key_len) > sizeof(state.store.data)) {
+        err = -EINVAL;
+    } else {
+        memmove(state.store.data + new_key_len,
+                state.store.data + old_key_len,
+                state.len - old_key_len);
+        memcpy(state.store.data, new_key, new_key_len);
+        state.len = new_key_len + (state.len - old_key_len);
+        err = history_scan();
+    }
+
+    if (err < 0) {
+        LOG_ERR("Discarding corrupt history");
+        state.len = 0;
+        state.count = 0;
+        goto out;
+    }
+
+    // Records added after the commit were lost. Skip their sequence numbers
+    // so a client that already downloaded them does not miss new records.
+    state.next_seq = state.tail.last.seq + 1 + CONFIG_HISTORY_COMMIT_INTERVAL;
+    // Continue the numbering clients already know. A client that selected
+    // records before the restore sees the epoch change and starts over, which
+    // only downloads records twice.
+    state.epoch = state.store.epoch;
+
+    LOG_INF("Restored %zu history records (%zu bytes)", state.count, state.len);
+
+out:
+    k_mutex_unlock(&history_lock);
+    return err;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(history_settings, "hist", NULL, history_settings_set, NULL, NULL);
+
+static void history_commit(void) {
+    int err;
+
+    state.store.uptime = k_uptime_seconds();
+    state.store.epoch = history_epoch();
+    IF_ERR(settings_save_one("hist/store",
+                             &state.store,
+                             offsetof(struct history_store, data) + state.len)) {
+        LOG_ERR("Failed to commit history (err %d)", err);
+        return;
+    }
+
+    state.uncommitted = 0;
+    LOG_DBG("Committed %zu history records (%zu bytes)", state.count, state.len);
+}
+
+void history_add(void) {
+    struct history_entry entry = {
+        .record =
+            {
+                .time = k_uptime_seconds(),
+                .water_level = water_level_get(),
+                .water_distance = water_level_get_water_distance(),
+                .temperature = (int16_t)temperature_get(),
+                .voltage = battery_get_voltage(),
+            },
+    };
+
+    k_mutex_lock(&history_lock, K_FOREVER);
+
+    entry.seq = state.next_seq++;
+
+    for (;;) {
+        struct codec_state next = state.tail;
+        uint8_t buf[CODEC_MAX_LEN];
+        size_t n;
+        if (state.count == 0) {
+            next.interval = entry.record.time - next.last.record.time;
+            next.last = entry;
+            n = codec_encode_key(&next, buf, sizeof(buf));
+        } else {
+            n = codec_encode(&next, &entry, buf, sizeof(buf));
+        }
+
+        if (state.len + n <= sizeof(state.store.data)) {
+            memcpy(state.store.data + state.len, buf, n);
+            state.len += n;
+            ++state.count;
+            state.tail = next;
+            break;
+        }
+
+        history_drop_oldest();
+    }
+
+    if (++state.uncommitted >= CONFIG_HISTORY_COMMIT_INTERVAL) {
+        history_commit();
+    }
+
+    k_mutex_unlock(&history_lock);
+}
+
+void history_select(uint32_t seq) {
+    k_mutex_lock(&history_lock, K_FOREVER);
+
+    struct codec_state s;
+    size_t pos;
+    state.select_seq = seq;
+    state.select_header.uptime = k_uptime_seconds();
+    state.select_header.epoch = history_epoch();
+    state.select_found = history_find(seq, &s, &pos);
+    state.select_len = 0;
+
+    if (state.select_found) {
+        state.select_first = s.last.seq;
+        uint8_t key[CODEC_MAX_LEN];
+        const size_t key_len = codec_encode_key(&s, key, sizeof(key));
+        const size_t max_len = HISTORY_MAX_READ_LEN - sizeof(state.select_header) - key_len;
+
+        // Include as many whole entries as fit in a long read
+        while (pos + state.select_len < state.len) {
+            const size_t start = pos + state.select_len;
+            struct codec_state next = s;
+            const size_t n = codec_decode(&next, state.store.data + start, state.len - start);
+            if (state.select_len + n > max_len) break;
+            state.select_len += n;
+            s = next;
+        }
+        state.select_header.next_seq = s.last.seq + 1;
+    } else {
+        state.select_header.next_seq = MAX(seq, state.next_seq);
+    }
+
+    k_mutex_unlock(&history_lock);
+}
+
+/**
+ * Copy the part of src that overlaps the requested range of a read made up of
+ * several consecutive parts.
+ *
+ * @param offset offset of the read relative to the start of src, updated to be
+ *               relative to the end of src
+ */
+static void history_copy(uint8_t** out, size_t* offset, size_t* remaining, const void* src,
+                         size_t src_len) {
+    if (*offset >= src_len) {
+        *offset -= src_len;
+        return;
+    }
+
+    const size_t n = MIN(*remaining, src_len - *offset);
+    memcpy(*out, (const uint8_t*)src + *offset, n);
+    *out += n;
+    *remaining -= n;
+    *offset = 0;
+}
+
+int history_read(size_t offset, void* buf, size_t len) {
+    k_mutex_lock(&history_lock, K_FOREVER);
+
+    // Look the first entry up by sequence number again, since entries added
+    // after history_select() may have shifted the stream. The selected
+    // entries themselves only change if the first one was dropped, in which
+    // case the parts of a long read would not fit together.
+    struct codec_state s;
+    size_t pos = 0;
+    uint8_t key[CODEC_MAX_LEN];
+    size_t key_len = 0;
+    if (state.select_found) {
+        if (!history_find(state.select_seq, &s, &pos) || s.last.seq != state.select_first) {
+            k_mutex_unlock(&history_lock);
+            return -EAGAIN;
+        }
+        key_len = codec_encode_key(&s, key, sizeof(key));
+    }
+    const size_t stream_len = state.select_len;
+
+    const size_t total = sizeof(state.select_header) + key_len + stream_len;
+    if (offset > total) {
+        k_mutex_unlock(&history_lock);
+        return -EINVAL;
+    }
+
+    len = MIN(len, total - offset);
+    uint8_t* out = buf;
+    size_t remaining = len;
+    history_copy(&out, &offset, &remaining, &state.select_header, sizeof(state.select_header));
+    history_copy(&out, &offset, &remaining, key, key_len);
+    history_copy(&out, &offset, &remaining, state.store.data + pos, stream_len);
+
+    k_mutex_unlock(&history_lock);
+    return len;
+}
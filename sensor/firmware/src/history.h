@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+/**
+ * A single measurement as stored in the history and sent over BLE.
+ */
+struct history_record {
+    // Seconds since boot. Records restored from flash after a reset are
+    // rebased to negative values, see history_settings_set().
+    int32_t time;
+    uint16_t water_level;     // mm
+    uint16_t water_distance;  // mm
+    int16_t temperature;      // 0.01 C
+    uint16_t voltage;         // mV
+} __packed;
+
+/**
+ * A record along with its sequence number.
+ */
+struct history_entry {
+    uint32_t seq;
+    struct history_record record;
+};
+
+/**
+ * Header preceding the records returned by history_read().
+ */
+struct history_header {
+    // Seconds since boot when history_select() was called
+    uint32_t uptime;
+    // Sequence number to select to continue after the records that follow
+    uint32_t next_seq;
+    // Random value identifying the sequence numbering. It changes when the
+    // numbering restarts because the history was lost in a reset, after which
+    // clients must start again from 0.
+    uint32_t epoch;
+} __packed;
+
+/**
+ * Append the current measurements to the history and periodically commit the
+ * history to flash.
+ */
+void history_add(void);
+
+/**
+ * Select the records returned by history_read(), starting at the oldest record
+ * with a sequence number of at least seq.
+ *
+ * @param seq first sequence number the client is interested in
+ */
+void history_select(uint32_t seq);
+
+/**
+ * Read part of the selected history, consisting of a struct history_header
+ * followed by as many records as fit in a single long GATT read, encoded as a
+ * codec stream (see codec.h). Sequence
+ * numbers are increasing but may skip values after a reset, so clients should
+ * continue from history_header.next_seq rather than counting records. They
+ * only restart from 0 together with a new history_header.epoch.
+ *
+ * @param offset offset into the serialized history
+ * @param buf buffer to read into
+ * @param len size of buf
+ * @return number of bytes read, -EINVAL if offset is past the end, or -EAGAIN
+ *         if the selected records were dropped, after which the client must
+ *         select again
+ */
+int history_read(size_t offset, void* buf, size_t len);
@@ -0,0 +1,82 @@
+#include "persist.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "common.h"
+
+LOG_MODULE_REGISTER(persist);
+
+// Largest value that can wait to be saved, larger ones are saved right away
+#define PERSIST_MAX_LEN 16
+
+static void persist_work_handler(struct k_work* work);
+
+K_WORK_DELAYABLE_DEFINE(persist_work, persist_work_handler);
+
+K_MUTEX_DEFINE(persist_lock);
+
+// Settings waiting to be saved. An entry is free if its key is NULL.
+static struct {
+    const char* key;
+    uint8_t len;
+    uint8_t value[PERSIST_MAX_LEN];
+} pending[CONFIG_PERSIST_ENTRIES];
+
+int persist_save(const char* key, const void* value, size_t len) {
+    if (len > PERSIST_MAX_LEN) {
+        return settings_save_one(key, value, len);
+    }
+
+    k_mutex_lock(&persist_lock, K_FOREVER);
+
+    size_t free = ARRAY_SIZE(pending);
+    size_t i;
+    for (i = 0; i < ARRAY_SIZE(pending); ++i) {
+        if (pending[i].key && !strcmp(pending[i].key, key)) break;
+        if (!pending[i].key && free == ARRAY_SIZE(pending)) free = i;
+    }
+    if (i == ARRAY_SIZE(pending)) i = free;
+
+    if (i == ARRAY_SIZE(pending)) {
+        k_mutex_unlock(&persist_lock);
+        LOG_WRN("No room to defer saving %s", key);
+        return settings_save_one(key, value, len);
+    }
+
+    pending[i].key = key;
+    pending[i].len = len;
+    memcpy(pending[i].value, value, len);
+
+    k_mutex_unlock(&persist_lock);
+
+    // Wait until the client is done changing settings
+    k_work_reschedule(&persist_work, K_SECONDS(CONFIG_PERSIST_DELAY));
+    return 0;
+}
+
+void persist_flush(void) {
+    int err;
+
+    k_work_cancel_delayable(&persist_work);
+
+    k_mutex_lock(&persist_lock, K_FOREVER);
+
+    for (size_t i = 0; i < ARRAY_SIZE(pending); ++i) {
+        if (!pending[i].key) continue;
+
+        IF_ERR(settings_save_one(pending[i].key, pending[i].value, pending[i].len)) {
+            LOG_ERR("Failed to save %s (err %d)", pending[i].key, err);
+        } else {
+            LOG_DBG("Saved %s", pending[i].key);
+        }
+        pending[i].key = NULL;
+    }
+
+    k_mutex_unlock(&persist_lock);
+}
+
+static void persist_work_handler(struct k_work* work) { persist_flush(); }
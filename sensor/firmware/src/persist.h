@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Save a setting later instead of right away. Repeated saves of the same key
+ * before the flush only write the last value, so a client tuning a setting
+ * over BLE does not wear the flash with every write.
+ *
+ * Pending settings are written by persist_flush(), or once no setting has
+ * changed for CONFIG_PERSIST_DELAY seconds. They are lost on reset.
+ *
+ * @param key settings key, which must stay valid until the flush (a string
+ *            literal)
+ * @return 0 on success, negative error code if the value had to be saved
+ *         right away and that failed
+ */
+int persist_save(const char* key, const void* value, size_t len);
+
+/**
+ * Write all pending settings.
+ */
+void persist_flush(void);
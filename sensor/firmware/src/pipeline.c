@@ -0,0 +1,226 @@
+#include "pipeline.h"
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "battery.h"
+#include "bluetooth.h"
+#include "common.h"
+#include "energy.h"
+#include "history.h"
+#include "persist.h"
+#include "power.h"
+#include "schedule.h"
+#include "temperature.h"
+#include "watchdog.h"
+#include "water_level.h"
+
+LOG_MODULE_REGISTER(pipeline);
+
+K_THREAD_STACK_DEFINE(pipeline_stack, CONFIG_PIPELINE_STACK_SIZE);
+
+// Expected duration of each stage in ms, longer runs are counted as overruns
+static const uint32_t deadlines[] = {
+    [PIPELINE_BATTERY] = 100,
+    [PIPELINE_SENSORS] = 100,
+    // The default 30 pings with their spacing and echo timeouts
+    [PIPELINE_WATER_LEVEL] = 4000,
+    // Includes saving settings and the history to flash
+    [PIPELINE_PUBLISH] = 500,
+};
+
+static void pipeline_battery(struct k_work* work);
+static void pipeline_sensors(struct k_work* work);
+static void pipeline_water_level(struct k_work* work);
+static void pipeline_publish(struct k_work* work);
+
+static struct {
+    struct k_work_q queue;
+    struct k_work_delayable battery_work;
+    struct k_work sensors_work;
+    struct k_work water_level_work;
+    struct k_work publish_work;
+    int64_t start;        // uptime at the start of the update
+    int64_t stage_start;  // uptime at the start of the current stage
+    // Rangefinder was powered on for this update
+    bool powered;
+    // Water level is measured in this update
+    bool measuring;
+    // Battery was measured with the rangefinder powered on
+    bool loaded;
+    struct pipeline_timing timing;
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    // Highest stack usage seen so far, in bytes
+    size_t stack_used;
+#endif
+} state;
+
+static struct k_spinlock timing_lock;
+
+static void pipeline_stage_begin(enum pipeline_stage stage) {
+    watchdog_begin(stage, deadlines[stage]);
+}
+
+/**
+ * Record the duration of a finished stage and move on to the next one.
+ */
+static void pipeline_stage_done(enum pipeline_stage stage, struct k_work* next) {
+    const int64_t now = k_uptime_get();
+
+    watchdog_end(stage);
+
+    K_SPINLOCK(&timing_lock) {
+        state.timing.stage[stage] = MIN(now - state.stage_start, UINT16_MAX);
+    }
+    state.stage_start = now;
+
+    if (next != NULL) {
+        k_work_submit_to_queue(&state.queue, next);
+    }
+}
+
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+/**
+ * Log the stack high-water mark whenever it grows, which is what
+ * PIPELINE_STACK_SIZE is sized from.
+ */
+static void pipeline_check_stack(void) {
+    size_t unused;
+
+    if (k_thread_stack_space_get(&state.queue.thread, &unused) < 0) return;
+
+    const size_t size = K_THREAD_STACK_SIZEOF(pipeline_stack);
+    const size_t used = size - unused;
+    if (used > state.stack_used) {
+        state.stack_used = used;
+        LOG_INF("Stack high-water mark: %zu of %zu bytes", used, size);
+    }
+}
+#endif
+
+static void pipeline_battery(struct k_work* work) {
+    int err;
+
+    pipeline_stage_begin(PIPELINE_BATTERY);
+    state.start = k_uptime_get();
+    state.stage_start = state.start;
+
+    // Measure at rest, before the rangefinder is switched on
+    IF_ERR(battery_update()) {
+        LOG_ERR("Failed to update battery (err %d)", err);
+        bluetooth_set_error(ERROR_BATTERY);
+    }
+
+    // The rangefinder warms up while the other sensors are read
+    const struct power_policy* policy = power_get_policy();
+    state.powered = false;
+    state.measuring = false;
+    state.loaded = false;
+    if (policy->measure || policy->load_test) {
+        IF_ERR(water_level_power_on()) {
+            bluetooth_set_error(ERROR_WATER_LEVEL);
+        } else {
+            state.powered = true;
+            state.measuring = policy->measure;
+        }
+    }
+    if (!policy->measure) {
+        LOG_WRN("Not updating water level in heartbeat mode");
+    }
+
+    pipeline_stage_done(PIPELINE_BATTERY, &state.sensors_work);
+}
+
+static void pipeline_sensors(struct k_work* work) {
+    int err;
+
+    pipeline_stage_begin(PIPELINE_SENSORS);
+
+    IF_ERR(temperature_update()) {
+        LOG_ERR("Failed to update temperature (err %d)", err);
+        bluetooth_set_error(ERROR_TEMPERATURE);
+    }
+
+    if (state.powered) {
+        // The supply is at its lowest with the rangefinder powered
+        IF_ERR(battery_update_loaded()) {
+            LOG_WRN("Failed to measure battery under load (err %d)", err);
+        } else {
+            state.loaded = true;
+        }
+    }
+
+    pipeline_stage_done(PIPELINE_SENSORS, &state.water_level_work);
+}
+
+static void pipeline_water_level(struct k_work* work) {
+    int err;
+
+    pipeline_stage_begin(PIPELINE_WATER_LEVEL);
+
+    if (state.measuring) {
+        IF_ERR(water_level_update()) {
+            LOG_ERR("Failed to update water level (err %d)", err);
+            bluetooth_set_error(ERROR_WATER_LEVEL);
+        }
+    } else if (state.powered) {
+        // Only powered on to test the battery under load
+        water_level_power_off();
+    }
+
+    pipeline_stage_done(PIPELINE_WATER_LEVEL, &state.publish_work);
+}
+
+static void pipeline_publish(struct k_work* work) {
+    pipeline_stage_begin(PIPELINE_PUBLISH);
+
+    // The supply dips lowest under load, which is what resets the sensor
+    power_update(battery_get_loaded_voltage(), state.loaded);
+
+    history_add();
+
+    // Choose the period before announcing the data, so it can be read along
+    // with it
+    const uint32_t period = schedule_update();
+
+    bluetooth_broadcast();
+
+    // Save settings changed during the last period together
+    persist_flush();
+    energy_update();
+
+    pipeline_stage_done(PIPELINE_PUBLISH, NULL);
+
+    const uint16_t total = MIN(state.stage_start - state.start, UINT16_MAX);
+    K_SPINLOCK(&timing_lock) { state.timing.total = total; }
+    LOG_DBG("Update took %u ms", total);
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    pipeline_check_stack();
+#endif
+
+    // Period is measured from the start of the update
+    k_work_schedule_for_queue(&state.queue,
+                              &state.battery_work,
+                              K_TIMEOUT_ABS_MS(state.start + (int64_t)period * MSEC_PER_SEC));
+}
+
+void pipeline_start(void) {
+    static const struct k_work_queue_config config = {.name = "pipeline"};
+
+    k_work_init_delayable(&state.battery_work, pipeline_battery);
+    k_work_init(&state.sensors_work, pipeline_sensors);
+    k_work_init(&state.water_level_work, pipeline_water_level);
+    k_work_init(&state.publish_work, pipeline_publish);
+
+    k_work_queue_start(&state.queue,
+                       pipeline_stack,
+                       K_THREAD_STACK_SIZEOF(pipeline_stack),
+                       CONFIG_PIPELINE_PRIORITY,
+                       &config);
+    k_work_schedule_for_queue(&state.queue, &state.battery_work, K_NO_WAIT);
+}
+
+void pipeline_get_timing(struct pipeline_timing* timing) {
+    K_SPINLOCK(&timing_lock) { *timing = state.timing; }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+/**
+ * Stages of an update, run one after another on the pipeline work queue.
+ */
+enum pipeline_stage {
+    // Battery at rest, then rangefinder power on
+    PIPELINE_BATTERY,
+    // Temperature and battery under load, while the rangefinder warms up
+    PIPELINE_SENSORS,
+    PIPELINE_WATER_LEVEL,
+    // Power mode, history, schedule and broadcast
+    PIPELINE_PUBLISH,
+    PIPELINE_STAGE_COUNT,
+};
+
+/**
+ * Durations of the last update.
+ */
+struct pipeline_timing {
+    // Duration of each stage in ms
+    uint16_t stage[PIPELINE_STAGE_COUNT];
+    // Time from the start of the update until it was published in ms
+    uint16_t total;
+} __packed;
+
+/**
+ * Start the pipeline work queue and run the first update. Must be called once
+ * all modules are initialized.
+ */
+void pipeline_start(void);
+
+void pipeline_get_timing(struct pipeline_timing* timing);
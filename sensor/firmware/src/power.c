@@ -0,0 +1,176 @@
+#include "power.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+
+#ifdef CONFIG_POWER_POF
+#include <nrfx_power.h>
+#endif
+
+#include "bluetooth.h"
+
+LOG_MODULE_REGISTER(power);
+
+static const struct power_policy policies[] = {
+    [POWER_NORMAL] =
+        {
+            .max_samples = UINT8_MAX,
+            .period_factor = 1,
+            .slow_advertising = false,
+            .measure = true,
+        },
+    [POWER_SAVING] =
+        {
+            .max_samples = CONFIG_POWER_SAVING_SAMPLES,
+            .period_factor = 2,
+            .slow_advertising = false,
+            .measure = true,
+        },
+    [POWER_LOW] =
+        {
+            .max_samples = CONFIG_POWER_LOW_SAMPLES,
+            .period_factor = 4,
+            .slow_advertising = true,
+            .measure = true,
+        },
+    [POWER_HEARTBEAT] =
+        {
+            .max_samples = 0,
+            .period_factor = UINT8_MAX,
+            .slow_advertising = true,
+            .measure = false,
+            .load_test = true,
+        },
+};
+
+// Battery voltage below which each mode is entered, in mV
+static const uint16_t thresholds[] = {
+    [POWER_SAVING] = CONFIG_POWER_SAVING_VOLTAGE,
+    [POWER_LOW] = CONFIG_POWER_LOW_VOLTAGE,
+    [POWER_HEARTBEAT] = CONFIG_POWER_HEARTBEAT_VOLTAGE,
+};
+
+static const char* const mode_names[] = {"normal", "saving", "low", "heartbeat"};
+
+static atomic_t mode = ATOMIC_INIT(POWER_NORMAL);
+
+#ifdef CONFIG_POWER_POF
+#if defined(CONFIG_POWER_POF_THRESHOLD_2V1)
+#define POWER_POF_THRESHOLD NRF_POWER_POFTHR_V21
+#define POWER_POF_VOLTAGE 2100
+#elif defined(CONFIG_POWER_POF_THRESHOLD_2V3)
+#define POWER_POF_THRESHOLD NRF_POWER_POFTHR_V23
+#define POWER_POF_VOLTAGE 2300
+#elif defined(CONFIG_POWER_POF_THRESHOLD_2V5)
+#define POWER_POF_THRESHOLD NRF_POWER_POFTHR_V25
+#define POWER_POF_VOLTAGE 2500
+#else
+#define POWER_POF_THRESHOLD NRF_POWER_POFTHR_V27
+#define POWER_POF_VOLTAGE 2700
+#endif
+
+static void power_pof_work_handler(struct k_work* work);
+
+K_WORK_DEFINE(pof_work, power_pof_work_handler);
+
+static void power_pof_handler(void) {
+    // Stop using the rangefinder right away, a measurement in progress checks
+    // the mode between pings
+    atomic_set(&mode, POWER_HEARTBEAT);
+    k_work_submit(&pof_work);
+}
+
+static const nrfx_power_pofwarn_config_t pof_config = {
+    .handler = power_pof_handler,
+    .thr = POWER_POF_THRESHOLD,
+};
+
+static void power_pof_work_handler(struct k_work* work) {
+    // The warning repeats for as long as the supply stays low
+    nrfx_power_pof_disable();
+
+    LOG_WRN("Power failure warning, entering heartbeat mode");
+    bluetooth_set_error(ERROR_BROWNOUT);
+    bluetooth_set_status(STATUS_LOW_POWER, true);
+}
+
+// Leaving heartbeat mode below the warning threshold would only trip the
+// warning again with the next ping
+#define POWER_HEARTBEAT_EXIT_VOLTAGE MAX(CONFIG_POWER_HEARTBEAT_VOLTAGE, POWER_POF_VOLTAGE)
+#else
+#define POWER_HEARTBEAT_EXIT_VOLTAGE CONFIG_POWER_HEARTBEAT_VOLTAGE
+#endif
+
+int power_init(void) {
+#ifdef CONFIG_POWER_POF
+    static const nrfx_power_config_t config = {0};
+    const nrfx_err_t err = nrfx_power_init(&config);
+    if (err != NRFX_SUCCESS && err != NRFX_ERROR_ALREADY_INITIALIZED) {
+        return -EIO;
+    }
+
+    nrfx_power_pof_init(&pof_config);
+    nrfx_power_pof_enable(&pof_config);
+#endif
+
+    return 0;
+}
+
+/**
+ * Find the mode for a voltage. Leaving a mode takes a higher voltage than
+ * entering it, so the mode does not flap with noise or recovery after load.
+ */
+static enum power_mode power_mode_for(uint16_t voltage, enum power_mode current) {
+    enum power_mode next = POWER_NORMAL;
+
+    for (enum power_mode m = POWER_SAVING; m < POWER_MODE_COUNT; ++m) {
+        uint32_t threshold = thresholds[m];
+        if (m <= current) {
+            if (m == POWER_HEARTBEAT) {
+                threshold = POWER_HEARTBEAT_EXIT_VOLTAGE;
+            }
+            threshold += CONFIG_POWER_HYSTERESIS;
+        }
+        if (voltage < threshold) {
+            next = m;
+        }
+    }
+
+    return next;
+}
+
+void power_update(uint16_t voltage, bool loaded) {
+    if (voltage == 0) {
+        // Battery was never measured
+        return;
+    }
+
+    const enum power_mode current = atomic_get(&mode);
+    if (current == POWER_HEARTBEAT && !loaded) {
+        // Heartbeat mode was entered because the supply sagged under load,
+        // which the resting voltage says nothing about
+        return;
+    }
+    const enum power_mode next = power_mode_for(voltage, current);
+    if (next == current) {
+        return;
+    }
+
+    LOG_WRN("Power mode: %s (%u mV)", mode_names[next], voltage);
+    atomic_set(&mode, next);
+
+    if (next == POWER_HEARTBEAT) {
+        bluetooth_set_error(ERROR_BROWNOUT);
+    }
+#ifdef CONFIG_POWER_POF
+    if (current == POWER_HEARTBEAT) {
+        nrfx_power_pof_enable(&pof_config);
+    }
+#endif
+    bluetooth_set_status(STATUS_LOW_POWER, next != POWER_NORMAL);
+}
+
+enum power_mode power_get_mode(void) { return atomic_get(&mode); }
+
+const struct power_policy* power_get_policy(void) { return &policies[atomic_get(&mode)]; }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Operating modes, from most to least capable. The sensor steps down through
+ * them as the battery runs out.
+ */
+enum power_mode {
+    POWER_NORMAL,
+    POWER_SAVING,
+    POWER_LOW,
+    // Only report the battery state, the rangefinder is not used
+    POWER_HEARTBEAT,
+    POWER_MODE_COUNT,
+};
+
+/**
+ * What the sensor may do in a power mode.
+ */
+struct power_policy {
+    // Upper bound on the configured number of distance samples
+    uint8_t max_samples;
+    // Multiplier for the update period, limited by the maximum period
+    uint8_t period_factor;
+    // Advertise at the maximum interval only, without fast bursts
+    bool slow_advertising;
+    // Measure the water level
+    bool measure;
+    // Power on the rangefinder without measuring, only to measure the
+    // battery under load
+    bool load_test;
+};
+
+/**
+ * Set up the power failure comparator, which drops into heartbeat mode as
+ * soon as the supply sags below its threshold, even in the middle of a
+ * measurement.
+ */
+int power_init(void);
+
+/**
+ * Choose the power mode from the latest battery voltage. Must be called after
+ * every battery update. Heartbeat mode is only left on a voltage measured
+ * under load, high enough to clear both its threshold and the power failure
+ * warning.
+ *
+ * @param voltage battery voltage in millivolts
+ * @param loaded the voltage was measured with the rangefinder powered on
+ */
+void power_update(uint16_t voltage, bool loaded);
+
+enum power_mode power_get_mode(void);
+
+const struct power_policy* power_get_policy(void);
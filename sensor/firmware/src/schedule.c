@@ -0,0 +1,144 @@
+#include "schedule.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/atomic.h>
+
+#include "common.h"
+#include "persist.h"
+#include "power.h"
+#include "water_level.h"
+
+LOG_MODULE_REGISTER(schedule);
+
+// Shortest period that can be configured, to protect the battery
+#define SCHEDULE_PERIOD_LIMIT 60
+
+struct schedule_bounds {
+    uint32_t min;  // s
+    uint32_t max;  // s
+};
+
+static struct {
+    // Period chosen from the water level, before adjusting for the battery
+    atomic_t period;      // s
+    atomic_t period_min;  // s
+    atomic_t period_max;  // s
+
+    // Last successful water level measurement
+    bool have_level;
+    uint16_t level;      // mm
+    int64_t level_time;  // ms
+} state = {
+    .period = ATOMIC_INIT(CONFIG_SCHEDULE_PERIOD_DEFAULT),
+    .period_min = ATOMIC_INIT(CONFIG_SCHEDULE_PERIOD_MIN),
+    .period_max = ATOMIC_INIT(CONFIG_SCHEDULE_PERIOD_MAX),
+};
+
+static bool schedule_bounds_valid(const struct schedule_bounds* bounds) {
+    return bounds->min >= SCHEDULE_PERIOD_LIMIT && bounds->min <= bounds->max;
+}
+
+static int schedule_settings_set(const char* key, size_t len_rd, settings_read_cb read_cb,
+                                 void* cb_arg) {
+    int err;
+    int len = settings_name_next(key, NULL);
+    if (!strncmp(key, "b", len)) {
+        struct schedule_bounds bounds;
+        RET_ERR(read_cb(cb_arg, &bounds, sizeof(bounds)));
+        if (!schedule_bounds_valid(&bounds)) {
+            return -EINVAL;
+        }
+        atomic_set(&state.period_min, bounds.min);
+        atomic_set(&state.period_max, bounds.max);
+    } else {
+        return -ENOENT;
+    }
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(schedule_settings, "sch", NULL, schedule_settings_set, NULL, NULL);
+
+/**
+ * Get the rate of change of the water level since the last update. Changes
+ * within the measurement noise count as no change.
+ *
+ * @return absolute rate of change in mm/h, or -1 if unknown
+ */
+static int32_t schedule_get_slope(void) {
+    if (water_level_get_samples() == 0) {
+        // The level was not measured this time
+        return -1;
+    }
+
+    const uint16_t level = water_level_get();
+    const int64_t now = k_uptime_get();
+
+    int32_t slope = -1;
+    if (state.have_level && now > state.level_time) {
+        const int32_t change = abs((int32_t)level - state.level);
+        slope = change <= CONFIG_SCHEDULE_LEVEL_NOISE
+                    ? 0
+                    : (int32_t)(change * (int64_t)MSEC_PER_SEC * 3600 / (now - state.level_time));
+    }
+
+    state.have_level = true;
+    state.level = level;
+    state.level_time = now;
+
+    return slope;
+}
+
+uint32_t schedule_update(void) {
+    const uint32_t min = atomic_get(&state.period_min);
+    const uint32_t max = atomic_get(&state.period_max);
+    uint32_t period = atomic_get(&state.period);
+
+    const int32_t slope = schedule_get_slope();
+    if (slope >= CONFIG_SCHEDULE_FAST_SLOPE) {
+        // Level is changing quickly, follow it closely
+        period /= 2;
+    } else if (slope >= 0 && slope <= CONFIG_SCHEDULE_FLAT_SLOPE) {
+        period += period / 2;
+    }
+
+    atomic_set(&state.period, CLAMP(period, min, max));
+
+    period = schedule_get_period();
+    LOG_INF("Next update in %u s (slope %d mm/h)", period, slope);
+
+    return period;
+}
+
+uint32_t schedule_get_period(void) {
+    uint32_t period = atomic_get(&state.period);
+
+    // Stretch the period to save energy. This is applied separately so it
+    // doesn't feed back into the next decision.
+    const uint32_t factor = power_get_policy()->period_factor;
+    if (factor > 1) {
+        period = MIN(period * factor, atomic_get(&state.period_max));
+    }
+
+    return period;
+}
+
+void schedule_get_bounds(uint32_t* min, uint32_t* max) {
+    *min = atomic_get(&state.period_min);
+    *max = atomic_get(&state.period_max);
+}
+
+int schedule_set_bounds(uint32_t min, uint32_t max) {
+    const struct schedule_bounds bounds = {.min = min, .max = max};
+    if (!schedule_bounds_valid(&bounds)) {
+        return -EINVAL;
+    }
+
+    atomic_set(&state.period_min, min);
+    atomic_set(&state.period_max, max);
+    return persist_save("sch/b", &bounds, sizeof(bounds));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Choose the time until the next update, based on how fast the water level
+ * changed since the previous update and the battery level. Must be called
+ * after every update.
+ *
+ * @return update period in seconds
+ */
+uint32_t schedule_update(void);
+
+/**
+ * Get the current update period.
+ *
+ * @return update period in seconds
+ */
+uint32_t schedule_get_period(void);
+
+/**
+ * Get the bounds of the update period.
+ *
+ * @param min filled in with the minimum period in seconds
+ * @param max filled in with the maximum period in seconds
+ */
+void schedule_get_bounds(uint32_t* min, uint32_t* max);
+
+/**
+ * Set and persist the bounds of the update period.
+ *
+ * @param min minimum period in seconds
+ * @param max maximum period in seconds
+ * @return 0 on success, -EINVAL if the bounds are invalid
+ */
+int schedule_set_bounds(uint32_t min, uint32_t max);
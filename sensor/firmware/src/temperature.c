@@ -35,7 +35,7 @@ int temperature_update(void) {
     struct sensor_value temperature_value;
 
     RET_ERR(sensor_channel_get(state.sensor, SENSOR_CHAN_DIE_TEMP, &temperature_value));
-    // Convert to millicelsius
+    // Convert to hundredths of a degree
     int32_t temperature = temperature_value.val1 * 100 + temperature_value.val2 / 10000;
     // Bound to 16-bit (more than enough)
     temperature = clamp(temperature, INT16_MIN, INT16_MAX);
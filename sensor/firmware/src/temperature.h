@@ -7,8 +7,8 @@ int temperature_init(void);
 int temperature_update(void);
 
 /**
- * Get the temperature in millicelsius.
+ * Get the temperature in hundredths of a degree Celsius.
  *
- * @return temperature in mC
+ * @return temperature in 0.01 C
  */
 uint16_t temperature_get(void);
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "trend.h"
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+
+#include "bluetooth.h"
+
+LOG_MODULE_REGISTER(trend);
+
+struct trend_point {
+    uint32_t time;  // s
+    uint16_t level;  // mm
+};
+
+static struct {
+    struct trend_point points[CONFIG_TREND_WINDOW];
+    size_t count;
+    // Consecutive updates with a leak rate
+    size_t drain_count;
+
+    atomic_t flow_rate;  // 0.01 mm/h
+    atomic_t leak;
+} state = {
+    .flow_rate = ATOMIC_INIT(0),
+    .leak = ATOMIC_INIT(false),
+};
+
+/**
+ * Least squares slope of the level over time. Times are taken relative to the
+ * oldest point to keep the sums small enough for 64-bit integers.
+ *
+ * @return slope in 0.01 mm/h
+ */
+static int32_t trend_regression(void) {
+    const int64_t n = state.count;
+    int64_t sum_t = 0;
+    int64_t sum_l = 0;
+    int64_t sum_tt = 0;
+    int64_t sum_tl = 0;
+
+    for (size_t i = 0; i < state.count; ++i) {
+        const int64_t t = state.points[i].time - state.points[0].time;
+        const int64_t l = state.points[i].level;
+        sum_t += t;
+        sum_l += l;
+        sum_tt += t * t;
+        sum_tl += t * l;
+    }
+
+    const int64_t denominator = n * sum_tt - sum_t * sum_t;
+    if (denominator == 0) {
+        return 0;
+    }
+
+    // mm/s to 0.01 mm/h
+    const int64_t numerator = (n * sum_tl - sum_t * sum_l) * 3600 * 100;
+    return (int32_t)CLAMP(numerator / denominator, INT32_MIN, INT32_MAX);
+}
+
+void trend_add(uint16_t level) {
+    if (state.count == CONFIG_TREND_WINDOW) {
+        memmove(&state.points[0],
+                &state.points[1],
+                (CONFIG_TREND_WINDOW - 1) * sizeof(struct trend_point));
+        --state.count;
+    }
+
+    state.points[state.count++] = (struct trend_point){
+        .time = k_uptime_seconds(),
+        .level = level,
+    };
+
+    if (state.count < 2) {
+        return;
+    }
+
+    const int32_t flow_rate = trend_regression();
+    atomic_set(&state.flow_rate, flow_rate);
+
+    // Only trust a full window to decide that the tank is leaking
+    if (state.count == CONFIG_TREND_WINDOW && flow_rate <= -CONFIG_TREND_LEAK_RATE * 100) {
+        ++state.drain_count;
+    } else {
+        state.drain_count = 0;
+    }
+
+    const bool leak = state.drain_count >= CONFIG_TREND_LEAK_COUNT;
+    LOG_DBG("Flow rate: %d.%02d mm/h", flow_rate / 100, ABS(flow_rate) % 100);
+
+    if (leak != (bool)atomic_get(&state.leak)) {
+        LOG_WRN("Leak %s", leak ? "detected" : "cleared");
+        atomic_set(&state.leak, leak);
+        bluetooth_set_status(STATUS_LEAK, leak);
+        if (leak) {
+            bluetooth_alert();
+        }
+    }
+}
+
+int32_t trend_get_flow_rate(void) { return atomic_get(&state.flow_rate); }
+
+bool trend_get_leak(void) { return atomic_get(&state.leak); }
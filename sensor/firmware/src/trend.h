@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Add a water level measurement to the trend window and update the flow rate
+ * and leak state.
+ *
+ * @param level water level in mm
+ */
+void trend_add(uint16_t level);
+
+/**
+ * Get the rate of change of the water level, estimated by a linear regression
+ * over the recent measurements.
+ *
+ * @return flow rate in 0.01 mm/h, negative when draining, or 0 if there are
+ *         not enough measurements
+ */
+int32_t trend_get_flow_rate(void);
+
+/**
+ * Check whether the tank has been draining faster than the leak rate for
+ * several consecutive updates.
+ */
+bool trend_get_leak(void);
@@ -1,26 +1,210 @@
 #include "watchdog.h"
 
 #include <hal/nrf_power.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <zephyr/drivers/watchdog.h>
+#include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/logging/log_ctrl.h>
+#include <zephyr/sys/crc.h>
 #include <zephyr/sys/reboot.h>
 
 #include "bluetooth.h"
+#include "crash.h"
 
 LOG_MODULE_REGISTER(watchdog);
 
+// Feed often enough that a late feed never causes a reset
+#define WATCHDOG_FEED_INTERVAL_MS (CONFIG_WATCHDOG_TIMEOUT * MSEC_PER_SEC / 4)
+// Time for the system work queue to run a check in
+#define WATCHDOG_BLUETOOTH_DEADLINE_MS 500
+
+// Kept in RAM that is not cleared at boot, like the energy counters, so the
+// durations that led to a watchdog reset can be read after it
+struct watchdog_stats {
+    struct watchdog_report report;
+    // Task found hung, which should be followed by a watchdog reset
+    uint8_t hung;
+    uint32_t crc;
+};
+
+static __noinit struct watchdog_stats stats;
+
+static struct {
+    const struct device* const wdt;
+    int channel;
+    // Stop feeding the watchdog
+    bool starving;
+    struct {
+        bool running;
+        int64_t start;      // ms
+        uint32_t deadline;  // ms
+    } tasks[WATCHDOG_TASK_COUNT];
+} state = {
+    .wdt = DEVICE_DT_GET(DT_NODELABEL(wdt0)),
+    .channel = -1,
+};
+
+static struct k_spinlock lock;
+
+static void watchdog_supervise(struct k_timer* timer);
+static void watchdog_bluetooth_check_in(struct k_work* work);
+
+K_TIMER_DEFINE(supervisor_timer, watchdog_supervise, NULL);
+K_WORK_DEFINE(bluetooth_work, watchdog_bluetooth_check_in);
+
+static uint32_t watchdog_crc(void) {
+    return crc32_ieee((const uint8_t*)&stats, offsetof(struct watchdog_stats, crc));
+}
+
+static void watchdog_init_stats(bool watchdog_reset) {
+    if (stats.crc != watchdog_crc()) {
+        memset(&stats, 0, sizeof(stats));
+        stats.report.hung = WATCHDOG_NONE;
+        stats.hung = WATCHDOG_NONE;
+    }
+
+    if (watchdog_reset) {
+        if (stats.report.resets < UINT16_MAX) {
+            ++stats.report.resets;
+        }
+        // The supervisor did not catch a hang if interrupts were stuck
+        stats.report.hung = stats.hung;
+        LOG_WRN("Reset by watchdog, hung task: %u", stats.hung);
+    }
+    stats.hung = WATCHDOG_NONE;
+    stats.crc = watchdog_crc();
+}
+
+/**
+ * Record a finished or hung task. Must be called with the lock held.
+ */
+static void watchdog_record(unsigned int task, uint32_t duration) {
+    struct watchdog_task_stats* s = &stats.report.tasks[task];
+
+    s->worst = MAX(s->worst, MIN(duration, UINT16_MAX));
+    if (duration > state.tasks[task].deadline) {
+        s->last_overrun = MIN(duration, UINT16_MAX);
+        if (s->overruns < UINT16_MAX) {
+            ++s->overruns;
+        }
+    }
+    stats.crc = watchdog_crc();
+}
+
+static void watchdog_supervise(struct k_timer* timer) {
+    const int64_t now = k_uptime_get();
+    bool submit = false;
+
+    K_SPINLOCK(&lock) {
+        for (unsigned int i = 0; i < WATCHDOG_TASK_COUNT && !state.starving; ++i) {
+            if (!state.tasks[i].running) continue;
+
+            const int64_t elapsed = now - state.tasks[i].start;
+            if (elapsed > CONFIG_WATCHDOG_HANG_TIMEOUT * MSEC_PER_SEC) {
+                // Save the figures, then let the watchdog reset the sensor
+                state.starving = true;
+                stats.hung = i;
+                watchdog_record(i, elapsed);
+                LOG_ERR("Task %u hung for %lld ms, waiting for watchdog reset", i, elapsed);
+            }
+        }
+
+        // Time a round trip through the system work queue
+        if (!state.tasks[WATCHDOG_BLUETOOTH].running) {
+            state.tasks[WATCHDOG_BLUETOOTH].running = true;
+            state.tasks[WATCHDOG_BLUETOOTH].start = now;
+            state.tasks[WATCHDOG_BLUETOOTH].deadline = WATCHDOG_BLUETOOTH_DEADLINE_MS;
+            submit = true;
+        }
+    }
+
+    if (submit) {
+        k_work_submit(&bluetooth_work);
+    }
+
+    if (!state.starving && state.channel >= 0) {
+        wdt_feed(state.wdt, state.channel);
+    }
+}
+
+static void watchdog_bluetooth_check_in(struct k_work* work) { watchdog_end(WATCHDOG_BLUETOOTH); }
+
 int watchdog_init(void) {
+    int err;
+
     uint32_t reset_reason = nrf_power_resetreas_get(NRF_POWER);
     nrf_power_resetreas_clear(NRF_POWER, 0xFFFFFFFF);
 
-    if (reset_reason & (NRF_POWER_RESETREAS_SREQ_MASK | NRF_POWER_RESETREAS_LOCKUP_MASK)) {
+    if (reset_reason & (NRF_POWER_RESETREAS_SREQ_MASK | NRF_POWER_RESETREAS_LOCKUP_MASK |
+                        NRF_POWER_RESETREAS_DOG_MASK)) {
         bluetooth_set_error(ERROR_CRASH);
     }
 
+    // Nothing else uses the stats yet
+    watchdog_init_stats(reset_reason & NRF_POWER_RESETREAS_DOG_MASK);
+
+    if (!device_is_ready(state.wdt)) {
+        LOG_ERR_DEVICE_NOT_READY(state.wdt);
+        return -ENODEV;
+    }
+
+    const struct wdt_timeout_cfg config = {
+        .window.max = CONFIG_WATCHDOG_TIMEOUT * MSEC_PER_SEC,
+        .flags = WDT_FLAG_RESET_SOC,
+    };
+    err = wdt_install_timeout(state.wdt, &config);
+    if (err < 0) return err;
+    state.channel = err;
+
+    err = wdt_setup(state.wdt, WDT_OPT_PAUSE_HALTED_BY_DBG);
+    if (err < 0) return err;
+
+    k_timer_start(&supervisor_timer, K_NO_WAIT, K_MSEC(WATCHDOG_FEED_INTERVAL_MS));
+
     return 0;
 }
 
+void watchdog_begin(unsigned int task, uint32_t deadline) {
+    const int64_t now = k_uptime_get();
+
+    K_SPINLOCK(&lock) {
+        state.tasks[task].running = true;
+        state.tasks[task].start = now;
+        state.tasks[task].deadline = deadline;
+    }
+}
+
+void watchdog_end(unsigned int task) {
+    const int64_t now = k_uptime_get();
+    uint32_t duration = 0;
+    bool overrun = false;
+
+    K_SPINLOCK(&lock) {
+        if (!state.tasks[task].running) {
+            K_SPINLOCK_BREAK;
+        }
+        state.tasks[task].running = false;
+
+        duration = now - state.tasks[task].start;
+        overrun = duration > state.tasks[task].deadline;
+        watchdog_record(task, duration);
+    }
+
+    if (overrun) {
+        LOG_WRN("Task %u overran its deadline: %u ms", task, duration);
+    }
+}
+
+void watchdog_get_report(struct watchdog_report* report) {
+    K_SPINLOCK(&lock) { *report = stats.report; }
+}
+
 FUNC_NORETURN void k_sys_fatal_error_handler(unsigned int reason, const struct arch_esf* esf) {
+    crash_save(reason, esf);
+
     LOG_ERR("FATAL ERROR... Resetting");
     LOG_PANIC();
     sys_reboot(SYS_REBOOT_COLD);
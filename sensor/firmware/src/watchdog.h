@@ -1,3 +1,58 @@
 #pragma once
 
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+#include "pipeline.h"
+
+/*
+ * Tasks supervised by the watchdog: each pipeline stage, then the system work
+ * queue, which runs the Bluetooth host.
+ */
+#define WATCHDOG_BLUETOOTH PIPELINE_STAGE_COUNT
+#define WATCHDOG_TASK_COUNT (PIPELINE_STAGE_COUNT + 1)
+
+// No task hung
+#define WATCHDOG_NONE UINT8_MAX
+
+struct watchdog_task_stats {
+    // Longest run in ms
+    uint16_t worst;
+    // Duration of the last run that missed its deadline in ms, or 0
+    uint16_t last_overrun;
+    // Runs that missed their deadline
+    uint16_t overruns;
+} __packed;
+
+/**
+ * Task durations since the last power-on reset, kept across the resets caused
+ * by the watchdog.
+ */
+struct watchdog_report {
+    // Resets caused by the watchdog
+    uint16_t resets;
+    // Task that hung before the last watchdog reset, or WATCHDOG_NONE
+    uint8_t hung;
+    struct watchdog_task_stats tasks[WATCHDOG_TASK_COUNT];
+} __packed;
+
+/**
+ * Check the reset reason and start the hardware watchdog.
+ */
 int watchdog_init(void);
+
+/**
+ * Check in at the start of a task. The watchdog resets the sensor if the task
+ * does not finish within CONFIG_WATCHDOG_HANG_TIMEOUT.
+ *
+ * @param task pipeline stage or WATCHDOG_BLUETOOTH
+ * @param deadline expected duration in ms, longer runs are counted as overruns
+ */
+void watchdog_begin(unsigned int task, uint32_t deadline);
+
+/**
+ * Check in at the end of a task.
+ */
+void watchdog_end(unsigned int task);
+
+void watchdog_get_report(struct watchdog_report* report);
@@ -1,6 +1,8 @@
 #include "water_level.h"
 
+#include <app/drivers/sensor/jsn_sr04t.h>
 #include <stdint.h>
+#include <string.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/logging/log.h>
@@ -10,25 +12,66 @@
 
 #include "bluetooth.h"
 #include "common.h"
+#include "energy.h"
+#include "filter.h"
+#include "persist.h"
+#include "power.h"
+#include "temperature.h"
+#include "trend.h"
 #include "zephyr/sys/util.h"
 
 LOG_MODULE_REGISTER(water_level);
 
-#define NUM_WATER_SAMPLES 10
-#define MAX_WATER_SAMPLE_ATTEMPTS 30
+// Largest number of samples that can be configured, which sizes the sample
+// buffers
+#define WATER_SAMPLES_LIMIT 16
+// Wait long enough between samples to allow echoes to decay
+#define WATER_SAMPLE_SPACING K_MSEC(50)
+// Upper bound on the duration of a single ping in a burst, including spacing
+#define WATER_SAMPLE_MAX_DURATION_MS 100
+
+enum water_level_alert { ALERT_NONE, ALERT_HIGH, ALERT_LOW };
 
 static struct {
     const struct device* const rangefinder;
+#ifdef CONFIG_WATER_LEVEL_TEMP_SOURCE_EXTERNAL
+    const struct device* const air_temperature;
+#endif
     atomic_t water_level;     // mm
     atomic_t water_distance;  // mm
     atomic_t tank_depth;      // mm
+    atomic_t pings;           // pings sent for the last measurement
+    atomic_t samples;         // valid samples in the last measurement
+    int64_t powered;          // uptime when the rangefinder was powered on, or 0
+    // FIXME: not updated atomically, but a torn write only affects a single
+    //  threshold check or measurement
+    struct water_level_thresholds thresholds;
+    struct water_level_config config;
+    enum water_level_alert alert;
 } state = {
     .rangefinder = DEVICE_DT_GET(DT_NODELABEL(rangefinder)),
+#ifdef CONFIG_WATER_LEVEL_TEMP_SOURCE_EXTERNAL
+    .air_temperature = DEVICE_DT_GET(DT_ALIAS(air_temperature)),
+#endif
     .water_level = ATOMIC_INIT(0),
     .water_distance = ATOMIC_INIT(0),
     .tank_depth = ATOMIC_INIT(2000),
+    .pings = ATOMIC_INIT(0),
+    .samples = ATOMIC_INIT(0),
+    .config =
+        {
+            .samples = CONFIG_WATER_LEVEL_SAMPLES,
+            .max_attempts = CONFIG_WATER_LEVEL_MAX_ATTEMPTS,
+            .range = CONFIG_WATER_LEVEL_RANGE,
+        },
 };
 
+static bool water_level_config_valid(const struct water_level_config* config) {
+    return config->samples >= 1 && config->samples <= WATER_SAMPLES_LIMIT &&
+           config->max_attempts >= config->samples && config->range >= 100 &&
+           config->range <= 400;
+}
+
 static int water_level_settings_set(const char* key, size_t len_rd, settings_read_cb read_cb,
                                     void* cb_arg) {
     int err;
@@ -37,6 +80,15 @@ static int water_level_settings_set(const char* key, size_t len_rd, settings_rea
         uint16_t tank_depth;
         RET_ERR(read_cb(cb_arg, &tank_depth, sizeof(tank_depth)));
         atomic_set(&state.tank_depth, tank_depth);
+    } else if (!strncmp(key, "th", len)) {
+        RET_ERR(read_cb(cb_arg, &state.thresholds, sizeof(state.thresholds)));
+    } else if (!strncmp(key, "cfg", len)) {
+        struct water_level_config config;
+        RET_ERR(read_cb(cb_arg, &config, sizeof(config)));
+        if (!water_level_config_valid(&config)) {
+            return -EINVAL;
+        }
+        state.config = config;
     } else {
         return -ENOENT;
     }
@@ -52,37 +104,254 @@ int water_level_init(void) {
         return -ENODEV;
     }
 
+#ifdef CONFIG_WATER_LEVEL_TEMP_SOURCE_EXTERNAL
+    if (!device_is_ready(state.air_temperature)) {
+        LOG_ERR_DEVICE_NOT_READY(state.air_temperature);
+        return -ENODEV;
+    }
+#endif
+
     return 0;
 }
 
-int compare_uint32(const void* a, const void* b) {
-    uint32_t val_a = *(const uint32_t*)a;
-    uint32_t val_b = *(const uint32_t*)b;
+#ifdef CONFIG_WATER_LEVEL_TEMP_COMPENSATION
+static int water_level_get_air_temperature(struct sensor_value* temperature) {
+#ifdef CONFIG_WATER_LEVEL_TEMP_SOURCE_EXTERNAL
+    int err;
+    RET_ERR(sensor_sample_fetch_chan(state.air_temperature, SENSOR_CHAN_AMBIENT_TEMP));
+    return sensor_channel_get(state.air_temperature, SENSOR_CHAN_AMBIENT_TEMP, temperature);
+#else
+    // Hundredths of a degree
+    return sensor_value_from_milli(temperature, (int16_t)temperature_get() * 10);
+#endif
+}
+
+/**
+ * Pass the current air temperature to the rangefinder. On failure, the
+ * rangefinder keeps using the last temperature it was given.
+ */
+static void water_level_update_air_temperature(void) {
+    int err;
+    struct sensor_value temperature;
+
+    IF_ERR(water_level_get_air_temperature(&temperature)) {
+        LOG_WRN("Failed to get air temperature (err %d)", err);
+        return;
+    }
+
+    IF_ERR(sensor_attr_set(state.rangefinder,
+                           SENSOR_CHAN_AMBIENT_TEMP,
+                           (enum sensor_attribute)SENSOR_ATTR_SR04T_AIR_TEMPERATURE,
+                           &temperature)) {
+        LOG_WRN("Failed to set rangefinder air temperature (err %d)", err);
+    }
+}
+#endif
+
+/**
+ * Combine distance samples into a single estimate using the configured
+ * estimator. Reorders the samples.
+ */
+static uint32_t water_level_filter(uint32_t* samples, size_t count) {
+#if defined(CONFIG_WATER_LEVEL_FILTER_TRIMMED_MEAN)
+    return filter_trimmed_mean(
+        samples, count, count * CONFIG_WATER_LEVEL_FILTER_TRIM_PERCENT / 100);
+#elif defined(CONFIG_WATER_LEVEL_FILTER_MAD)
+    uint32_t scratch[WATER_SAMPLES_LIMIT];
+    return filter_mad_mean(samples, scratch, count, CONFIG_WATER_LEVEL_FILTER_MAD_THRESHOLD);
+#else
+    return filter_median(samples, count);
+#endif
+}
+
+/**
+ * Update the alert state from the latest level and alert the base station
+ * when a threshold is crossed.
+ */
+static void water_level_check_thresholds(uint32_t level) {
+    const struct water_level_thresholds* t = &state.thresholds;
+    enum water_level_alert alert = state.alert;
+
+    if (t->high != 0 && level >= t->high) {
+        alert = ALERT_HIGH;
+    } else if (t->low != 0 && level <= t->low) {
+        alert = ALERT_LOW;
+    } else if (alert == ALERT_HIGH && (t->high == 0 || level + t->hysteresis < t->high)) {
+        alert = ALERT_NONE;
+    } else if (alert == ALERT_LOW && (t->low == 0 || level > t->low + t->hysteresis)) {
+        alert = ALERT_NONE;
+    }
+
+    if (alert == state.alert) {
+        return;
+    }
+
+    static const char* const alert_names[] = {"none", "high", "low"};
+    LOG_WRN("Water level alert: %s (%u mm)", alert_names[alert], level);
+
+    state.alert = alert;
+    bluetooth_set_status(STATUS_ALERT, alert != ALERT_NONE);
+    bluetooth_alert();
+}
+
+/**
+ * Largest accepted distance. Distances much larger than the tank depth are
+ * multipath echoes.
+ */
+static uint32_t water_level_max_distance(void) {
+    return DIV_ROUND_CLOSEST(atomic_get(&state.tank_depth) * state.config.range, 100);
+}
+
+#ifdef CONFIG_WATER_LEVEL_ADAPTIVE_SAMPLING
+/**
+ * Count the samples within the tolerance of the median of all samples. Unlike
+ * the spread of the samples, this can grow again after an outlier, so a single
+ * multipath echo does not stop sampling from converging.
+ */
+static size_t water_level_agreeing_samples(const uint32_t* samples, size_t count) {
+    uint32_t sorted[WATER_SAMPLES_LIMIT];
+    memcpy(sorted, samples, count * sizeof(*samples));
+    const uint32_t median = filter_median(sorted, count);
+
+    size_t agreeing = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t deviation = samples[i] > median ? samples[i] - median : median - samples[i];
+        if (deviation <= CONFIG_WATER_LEVEL_SAMPLE_TOLERANCE) {
+            ++agreeing;
+        }
+    }
+    return agreeing;
+}
+#endif
+
+int water_level_power_on(void) {
+    int err;
+
+    // Don't wait for echoes from further away than we would accept
+    struct sensor_value max_range;
+    sensor_value_from_milli(&max_range, water_level_max_distance());
+    IF_ERR(sensor_attr_set(
+        state.rangefinder, SENSOR_CHAN_DISTANCE, SENSOR_ATTR_FULL_SCALE, &max_range)) {
+        LOG_WRN("Failed to set rangefinder range (err %d)", err);
+    }
+
+    err = pm_device_runtime_get(state.rangefinder);
+    if (err < 0) {
+        LOG_ERR("Failed to power on rangefinder (err %d)", err);
+        return err;
+    }
+    state.powered = k_uptime_get();
 
-    if (val_a < val_b) return -1;
-    if (val_a > val_b) return 1;
     return 0;
 }
 
+void water_level_power_off(void) {
+    if (state.powered == 0) {
+        return;
+    }
+
+    pm_device_runtime_put(state.rangefinder);
+    energy_add_time(ENERGY_RANGEFINDER, k_uptime_get() - state.powered);
+    state.powered = 0;
+}
+
 int water_level_update(void) {
     int err;
     const uint32_t tank_depth = atomic_get(&state.tank_depth);
-    // 6 samples >1.3x tank depth
-    const uint32_t max_distance_mm = tank_depth + DIV_ROUND_CLOSEST(tank_depth, 3);
+    struct water_level_config config = state.config;
 
-    pm_device_runtime_get(state.rangefinder);
+    if (state.powered == 0) {
+        return -EIO;
+    }
+
+    const struct power_policy* policy = power_get_policy();
+    if (config.samples > policy->max_samples) {
+        // Save the battery, trying each sample only a few times
+        config.samples = policy->max_samples;
+        config.max_attempts = MIN(config.max_attempts, config.samples * 3);
+    }
+    const uint32_t max_distance_mm = water_level_max_distance();
+#ifdef CONFIG_WATER_LEVEL_ADAPTIVE_SAMPLING
+    const size_t min_samples = MIN(CONFIG_WATER_LEVEL_MIN_SAMPLES, config.samples);
+#endif
 
-    uint32_t distance_mm_samples[NUM_WATER_SAMPLES];
+#ifdef CONFIG_WATER_LEVEL_TEMP_COMPENSATION
+    water_level_update_air_temperature();
+#endif
+
+    uint32_t distance_mm_samples[WATER_SAMPLES_LIMIT];
+    uint32_t echo_ns[WATER_SAMPLES_LIMIT];
+
+    struct k_poll_signal burst_signal;
+    k_poll_signal_init(&burst_signal);
+    struct k_poll_event burst_event =
+        K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &burst_signal);
 
     size_t samples = 0;
-    for (size_t tries = 0; tries < MAX_WATER_SAMPLE_ATTEMPTS && samples < NUM_WATER_SAMPLES;
-         ++tries) {
-        err = sensor_sample_fetch(state.rangefinder);
-        if (!err) {
-            struct sensor_value distance;
-            sensor_channel_get(state.rangefinder, SENSOR_CHAN_DISTANCE, &distance);
-
-            uint32_t distance_mm = (uint32_t)(distance.val1 * 1000 + distance.val2 / 1000);
+    size_t tries = 0;
+    size_t pings = 0;
+    bool converged = false;
+    bool stuck = false;
+    while (tries < config.max_attempts && samples < config.samples) {
+        if (!power_get_policy()->measure) {
+            // Supply is sagging, stop before it resets the sensor mid-ping
+            LOG_WRN("Abandoning measurement due to low power");
+            break;
+        }
+
+        // Ping just enough times to fill the remaining samples if every ping
+        // succeeds, then try again with another burst if some failed.
+        size_t count = config.samples - samples;
+#ifdef CONFIG_WATER_LEVEL_ADAPTIVE_SAMPLING
+        // Only ping up to the minimum number of samples, then one at a time
+        // so we can stop as soon as the samples agree.
+        count = samples < min_samples ? min_samples - samples : 1;
+#endif
+        count = MIN(count, config.max_attempts - tries);
+        const struct sr04t_burst burst = {
+            .echo_ns = echo_ns,
+            .count = count,
+            .spacing = WATER_SAMPLE_SPACING,
+            .timeout = K_MSEC(count * WATER_SAMPLE_MAX_DURATION_MS),
+        };
+
+        k_poll_signal_reset(&burst_signal);
+        burst_event.state = K_POLL_STATE_NOT_READY;
+        IF_ERR(sr04t_burst_start(state.rangefinder, &burst, &burst_signal)) {
+            LOG_ERR("Failed to start rangefinder burst (err %d)", err);
+            break;
+        }
+        // The burst gives up on its own after its timeout, so it is only
+        // late if the rangefinder startup, the last ping or the system work
+        // queue that runs it is stuck
+        const k_timeout_t poll_timeout =
+            K_MSEC(CONFIG_JSN_SR04T_STARTUP_TIME + (count + 1) * WATER_SAMPLE_MAX_DURATION_MS);
+        IF_ERR(k_poll(&burst_event, 1, poll_timeout)) {
+            LOG_ERR("Rangefinder burst did not finish (err %d)", err);
+            // The burst writes to buffers on this stack
+            sr04t_burst_cancel(state.rangefinder);
+            stuck = true;
+            break;
+        }
+
+        unsigned int signaled;
+        int result;
+        k_poll_signal_check(&burst_signal, &signaled, &result);
+        tries += burst.count;
+        if (result < 0) {
+            LOG_WRN("Rangefinder burst failed (err %d)", result);
+            continue;
+        }
+        // Bursts that hit their deadline leave later pings unsent
+        pings += result;
+
+        for (size_t i = 0; i < burst.count; ++i) {
+            if (0 == echo_ns[i]) {
+                LOG_WRN("Failed to read rangefinder (no echo)");
+                continue;
+            }
+
+            uint32_t distance_mm = sr04t_echo_to_mm(state.rangefinder, echo_ns[i]);
             // Only include reasonable distance samples
             if (distance_mm < max_distance_mm) {
                 distance_mm_samples[samples] = distance_mm;
@@ -91,14 +360,35 @@ int water_level_update(void) {
             } else {
                 LOG_WRN("Distance out of range: %u mm", distance_mm);
             }
-        } else {
-            LOG_WRN("Failed to read rangefinder (err %d)", err);
         }
-        // Wait long enough between samples to allow echoes to decay
-        k_sleep(K_MSEC(50));
+
+#ifdef CONFIG_WATER_LEVEL_ADAPTIVE_SAMPLING
+        // Too few samples to agree, possibly none at all if every ping failed
+        if (samples < min_samples) {
+            continue;
+        }
+        const size_t agreeing = water_level_agreeing_samples(distance_mm_samples, samples);
+        if (agreeing >= min_samples) {
+            LOG_DBG("%zu of %zu samples agree within %u mm, stopping",
+                    agreeing,
+                    samples,
+                    CONFIG_WATER_LEVEL_SAMPLE_TOLERANCE);
+            converged = true;
+            break;
+        }
+#endif
     }
 
-    pm_device_runtime_put(state.rangefinder);
+    water_level_power_off();
+    energy_add_events(ENERGY_PING, pings);
+
+    atomic_set(&state.pings, pings);
+    atomic_set(&state.samples, samples);
+    LOG_DBG("Used %zu pings for %zu samples", pings, samples);
+
+    if (stuck) {
+        return -ETIMEDOUT;
+    }
 
     if (0 == samples) {
         // No samples collected, don't update distance
@@ -107,29 +397,22 @@ int water_level_update(void) {
         return 0;
     }
 
-    if (samples != NUM_WATER_SAMPLES) {
+    if (samples != config.samples && !converged) {
         LOG_WRN("Only measured %d water level samples", samples);
         bluetooth_set_error(ERROR_WATER_LEVEL);
     }
 
-    // Median filter
-    qsort(distance_mm_samples, samples, sizeof(*distance_mm_samples), compare_uint32);
-    uint32_t distance_mm_filtered;
-    if (samples % 2 == 0) {
-        // Even number of samples, everage middle two
-        distance_mm_filtered = DIV_ROUND_CLOSEST(
-            distance_mm_samples[samples / 2] + distance_mm_samples[samples / 2 - 1],
-            2);
-    } else {
-        // Odd number of samples, single median value
-        distance_mm_filtered = distance_mm_samples[samples / 2];
-    }
+    const uint32_t distance_mm_filtered = water_level_filter(distance_mm_samples, samples);
 
-    LOG_INF("Distance (median): %u mm", distance_mm_filtered);
+    LOG_INF("Distance (filtered): %u mm", distance_mm_filtered);
 
     atomic_set(&state.water_distance, distance_mm_filtered);
-    atomic_set(&state.water_level,
-               tank_depth > distance_mm_filtered ? tank_depth - distance_mm_filtered : 0);
+    const uint32_t water_level =
+        tank_depth > distance_mm_filtered ? tank_depth - distance_mm_filtered : 0;
+    atomic_set(&state.water_level, water_level);
+
+    water_level_check_thresholds(water_level);
+    trend_add(water_level);
 
     return 0;
 }
@@ -140,9 +423,38 @@ uint16_t water_level_get_water_distance(void) {
     return (uint16_t)atomic_get(&state.water_distance);
 }
 
+uint8_t water_level_get_pings(void) { return (uint8_t)atomic_get(&state.pings); }
+
+uint8_t water_level_get_samples(void) { return (uint8_t)atomic_get(&state.samples); }
+
 uint16_t water_level_get_tank_depth(void) { return (uint16_t)atomic_get(&state.tank_depth); }
 
 void water_level_set_tank_depth(uint16_t depth) {
     atomic_set(&state.tank_depth, depth);
-    settings_save_one("wl/td", &depth, sizeof(depth));
+    persist_save("wl/td", &depth, sizeof(depth));
+}
+
+void water_level_get_thresholds(struct water_level_thresholds* thresholds) {
+    *thresholds = state.thresholds;
+}
+
+int water_level_set_thresholds(const struct water_level_thresholds* thresholds) {
+    if (thresholds->high != 0 && thresholds->low != 0 &&
+        thresholds->low + thresholds->hysteresis >= thresholds->high) {
+        return -EINVAL;
+    }
+
+    state.thresholds = *thresholds;
+    return persist_save("wl/th", thresholds, sizeof(*thresholds));
+}
+
+void water_level_get_config(struct water_level_config* config) { *config = state.config; }
+
+int water_level_set_config(const struct water_level_config* config) {
+    if (!water_level_config_valid(config)) {
+        return -EINVAL;
+    }
+
+    state.config = *config;
+    return persist_save("wl/cfg", config, sizeof(*config));
 }
@@ -2,14 +2,65 @@
 
 #include <stdint.h>
 
+/**
+ * Water level alert thresholds. A threshold of 0 is disabled.
+ */
+struct water_level_thresholds {
+    // Alert when the level rises to at least this many mm
+    uint16_t high;
+    // Alert when the level falls to at most this many mm
+    uint16_t low;
+    // Distance in mm the level must move back past a threshold to clear the
+    // alert
+    uint16_t hysteresis;
+} __packed;
+
+/**
+ * Sampling policy of a measurement.
+ */
+struct water_level_config {
+    // Distance samples to collect, 1-16
+    uint8_t samples;
+    // Maximum number of rangefinder pings, at least samples
+    uint8_t max_attempts;
+    // Largest accepted distance as a percentage of the tank depth, 100-400.
+    // Samples further away are rejected as outliers.
+    uint16_t range;
+} __packed;
+
 int water_level_init(void);
 
+/**
+ * Power on the rangefinder, which then warms up in the background until the
+ * first ping of water_level_update().
+ */
+int water_level_power_on(void);
+
+/**
+ * Power off the rangefinder without measuring.
+ */
+void water_level_power_off(void);
+
+/**
+ * Measure the water level and power off the rangefinder. Must follow a
+ * successful water_level_power_on().
+ */
 int water_level_update(void);
 
 uint16_t water_level_get(void);
 
 uint16_t water_level_get_water_distance(void);
 
+/**
+ * Get the number of rangefinder pings used by the last measurement.
+ */
+uint8_t water_level_get_pings(void);
+
+/**
+ * Get the number of valid samples the last measurement was computed from.
+ */
+uint8_t water_level_get_samples(void);
+
 uint16_t water_level_get_tank_depth(void);
 
 /**
@@ -17,4 +68,22 @@ uint16_t water_level_get_tank_depth(void);
  *
  * @param depth depth in millimeters
  */
-void water_level_set_tank_depth(uint16_t depth);
\ No newline at end of file
+void water_level_set_tank_depth(uint16_t depth);
+
+void water_level_get_thresholds(struct water_level_thresholds* thresholds);
+
+/**
+ * Set and persist the alert thresholds. Takes effect at the next update.
+ *
+ * @return 0 on success, -EINVAL if the thresholds overlap
+ */
+int water_level_set_thresholds(const struct water_level_thresholds* thresholds);
+
+void water_level_get_config(struct water_level_config* config);
+
+/**
+ * Set and persist the sampling policy. Takes effect at the next update.
+ *
+ * @return 0 on success, -EINVAL if the policy is invalid
+ */
+int water_level_set_config(const struct water_level_config* config);
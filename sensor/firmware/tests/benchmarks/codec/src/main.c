@@ -0,0 +1,135 @@
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/timing/timing.h>
+
+#include "codec.h"
+
+// Entries encoded for each scenario
+#define ITERATIONS 1000
+// Update period, in s
+#define PERIOD 600
+
+static uint32_t rand_state = 1;
+
+// Fixed sequence, so the figures are comparable between runs and boards
+static uint32_t bench_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 16;
+}
+
+static int32_t bench_noise(uint32_t amplitude) {
+    return (int32_t)(bench_rand() % (2 * amplitude + 1)) - (int32_t)amplitude;
+}
+
+/**
+ * Steady history: a regular period, and a water level, temperature and
+ * voltage that change a little between updates.
+ */
+static void bench_steady(struct history_entry* e) {
+    ++e->seq;
+    e->record.time += PERIOD;
+    e->record.water_level += bench_noise(3);
+    e->record.water_distance = 2000 - e->record.water_level;
+    e->record.temperature += bench_noise(20);
+    e->record.voltage += bench_noise(2);
+}
+
+/**
+ * Eventful history: the period changes with the power mode, a few entries
+ * are missing, and the tank is filled or drained quickly.
+ */
+static void bench_eventful(struct history_entry* e) {
+    static const int32_t periods[] = {60, 600, 3600};
+
+    e->seq += 1 + (bench_rand() % 16 == 0);
+    e->record.time += periods[bench_rand() % ARRAY_SIZE(periods)] + bench_noise(2);
+    e->record.water_level += bench_noise(200);
+    e->record.water_distance = 2000 - e->record.water_level;
+    e->record.temperature += bench_noise(300);
+    e->record.voltage += bench_noise(20);
+}
+
+static const struct {
+    const char* name;
+    void (*next)(struct history_entry* e);
+} scenarios[] = {
+    {"steady", bench_steady},
+    {"eventful", bench_eventful},
+};
+
+struct bench_result {
+    size_t bytes;
+    uint64_t encode_cycles;
+    uint64_t decode_cycles;
+};
+
+/**
+ * Encode and decode entries one at a time, as history_add() and the history
+ * characteristic do, timing only the codec calls.
+ *
+ * @return false if an entry did not round trip
+ */
+static bool bench_run(void (*next)(struct history_entry* e), struct bench_result* result) {
+    const struct history_entry first = {
+        .seq = 1,
+        .record = {.water_level = 1000, .water_distance = 1000, .temperature = 2000,
+                   .voltage = 2900},
+    };
+    struct codec_state enc = {.last = first};
+    struct codec_state dec = enc;
+    struct history_entry e = first;
+    uint8_t buf[CODEC_MAX_LEN];
+
+    // Same entries for every run
+    rand_state = 1;
+    *result = (struct bench_result){0};
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        next(&e);
+
+        timing_t start = timing_counter_get();
+        const size_t len = codec_encode(&enc, &e, buf, sizeof(buf));
+        timing_t end = timing_counter_get();
+        result->encode_cycles += timing_cycles_get(&start, &end);
+        result->bytes += len;
+
+        start = timing_counter_get();
+        const size_t read = codec_decode(&dec, buf, len);
+        end = timing_counter_get();
+        result->decode_cycles += timing_cycles_get(&start, &end);
+
+        if (len == 0 || read != len || dec.last.seq != e.seq) {
+            printk("Round trip failed at entry %zu\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void) {
+    timing_init();
+    timing_start();
+
+    printk("Unencoded: %zu bytes/record\n",
+           sizeof(((struct history_entry*)0)->seq) + sizeof(struct history_record));
+    for (size_t s = 0; s < ARRAY_SIZE(scenarios); ++s) {
+        struct bench_result result;
+        if (!bench_run(scenarios[s].next, &result)) return 1;
+
+        printk("%-8s: %u.%02u bytes/record, %llu cycles/encode (%llu ns), "
+               "%llu cycles/decode (%llu ns)\n",
+               scenarios[s].name,
+               (unsigned int)(result.bytes / ITERATIONS),
+               (unsigned int)(result.bytes * 100 / ITERATIONS % 100),
+               result.encode_cycles / ITERATIONS,
+               timing_cycles_to_ns(result.encode_cycles) / ITERATIONS,
+               result.decode_cycles / ITERATIONS,
+               timing_cycles_to_ns(result.decode_cycles) / ITERATIONS);
+    }
+
+    timing_stop();
+    printk("Codec benchmark done\n");
+
+    return 0;
+}
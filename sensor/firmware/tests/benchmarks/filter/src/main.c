@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/timing/timing.h>
+
+#include "filter.h"
+
+// Estimates timed for each estimator and sample count
+#define ITERATIONS 1000
+#define MAX_SAMPLES 16
+// Distance around which the samples are generated, in mm
+#define DISTANCE 1500
+
+static uint32_t rand_state = 1;
+
+// Fixed sequence, so the figures are comparable between runs and boards
+static uint32_t bench_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 16;
+}
+
+/**
+ * Fill in samples like those of a real measurement: a few mm of noise, and a
+ * multipath echo at twice the distance about one time in eight.
+ */
+static void bench_fill(uint32_t* samples, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = DISTANCE + bench_rand() % 8;
+        if (bench_rand() % 8 == 0) {
+            samples[i] *= 2;
+        }
+    }
+}
+
+static int bench_compare(const void* a, const void* b) {
+    const uint32_t x = *(const uint32_t*)a;
+    const uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t bench_qsort_median(uint32_t* samples, size_t count) {
+    qsort(samples, count, sizeof(*samples), bench_compare);
+    return samples[count / 2];
+}
+
+static uint32_t bench_median(uint32_t* samples, size_t count) {
+    return filter_median(samples, count);
+}
+
+static uint32_t bench_trimmed_mean(uint32_t* samples, size_t count) {
+    return filter_trimmed_mean(samples, count, count / 5);
+}
+
+static uint32_t bench_mad_mean(uint32_t* samples, size_t count) {
+    uint32_t scratch[MAX_SAMPLES];
+    return filter_mad_mean(samples, scratch, count, 30);
+}
+
+static const struct {
+    const char* name;
+    uint32_t (*estimate)(uint32_t* samples, size_t count);
+} estimators[] = {
+    {"qsort median", bench_qsort_median},
+    {"median", bench_median},
+    {"trimmed mean", bench_trimmed_mean},
+    {"MAD mean", bench_mad_mean},
+};
+
+static const size_t counts[] = {5, 10, 16};
+
+/**
+ * Time an estimator, excluding the time to generate the samples.
+ */
+static uint64_t bench_run(uint32_t (*estimate)(uint32_t*, size_t), size_t count) {
+    uint32_t samples[MAX_SAMPLES];
+    uint64_t cycles = 0;
+    volatile uint32_t result;
+
+    // Same samples for every estimator
+    rand_state = 1;
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        bench_fill(samples, count);
+
+        const timing_t start = timing_counter_get();
+        result = estimate(samples, count);
+        const timing_t end = timing_counter_get();
+
+        cycles += timing_cycles_get(&start, &end);
+    }
+    ARG_UNUSED(result);
+
+    return cycles;
+}
+
+int main(void) {
+    timing_init();
+    timing_start();
+
+    for (size_t e = 0; e < ARRAY_SIZE(estimators); ++e) {
+        for (size_t c = 0; c < ARRAY_SIZE(counts); ++c) {
+            const uint64_t cycles = bench_run(estimators[e].estimate, counts[c]);
+            printk("%-12s n=%2zu: %6llu cycles/estimate (%llu ns)\n",
+                   estimators[e].name,
+                   counts[c],
+                   cycles / ITERATIONS,
+                   timing_cycles_to_ns(cycles) / ITERATIONS);
+        }
+    }
+
+    timing_stop();
+    printk("Filter benchmark done\n");
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include <string.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/ztest.h>
+
+#include "codec.h"
+
+static struct history_entry entry(uint32_t seq, int32_t time, uint16_t water_level,
+                                  uint16_t water_distance, int16_t temperature,
+                                  uint16_t voltage) {
+    return (struct history_entry){
+        .seq = seq,
+        .record =
+            {
+                .time = time,
+                .water_level = water_level,
+                .water_distance = water_distance,
+                .temperature = temperature,
+                .voltage = voltage,
+            },
+    };
+}
+
+static void assert_entry(const struct history_entry* actual, const struct history_entry* expected) {
+    zassert_equal(actual->seq, expected->seq);
+    zassert_equal(actual->record.time, expected->record.time);
+    zassert_equal(actual->record.water_level, expected->record.water_level);
+    zassert_equal(actual->record.water_distance, expected->record.water_distance);
+    zassert_equal(actual->record.temperature, expected->record.temperature);
+    zassert_equal(actual->record.voltage, expected->record.voltage);
+}
+
+/**
+ * Encode a key holding only the given sequence number and time, which are
+ * the first fields of the key, and check their encoding. Every other field
+ * is zero and takes one byte.
+ */
+static void check_key_prefix(uint32_t seq, int32_t time, const uint8_t* expected, size_t len) {
+    const struct codec_state state = {.last = entry(seq, time, 0, 0, 0, 0)};
+    uint8_t buf[CODEC_MAX_LEN];
+
+    zassert_equal(codec_encode_key(&state, buf, sizeof(buf)), len + 5);
+    zassert_mem_equal(buf, expected, len);
+}
+
+ZTEST(codec, test_varint) {
+    check_key_prefix(0, 0, (const uint8_t[]){0x00, 0x00}, 2);
+    check_key_prefix(1, 0, (const uint8_t[]){0x01, 0x00}, 2);
+    check_key_prefix(127, 0, (const uint8_t[]){0x7f, 0x00}, 2);
+    check_key_prefix(128, 0, (const uint8_t[]){0x80, 0x01, 0x00}, 3);
+    check_key_prefix(300, 0, (const uint8_t[]){0xac, 0x02, 0x00}, 3);
+    check_key_prefix(16383, 0, (const uint8_t[]){0xff, 0x7f, 0x00}, 3);
+    check_key_prefix(16384, 0, (const uint8_t[]){0x80, 0x80, 0x01, 0x00}, 4);
+    check_key_prefix(UINT32_MAX, 0, (const uint8_t[]){0xff, 0xff, 0xff, 0xff, 0x0f, 0x00}, 6);
+}
+
+ZTEST(codec, test_zigzag) {
+    // Small values of either sign take one byte
+    check_key_prefix(0, 0, (const uint8_t[]){0x00, 0x00}, 2);
+    check_key_prefix(0, -1, (const uint8_t[]){0x00, 0x01}, 2);
+    check_key_prefix(0, 1, (const uint8_t[]){0x00, 0x02}, 2);
+    check_key_prefix(0, -2, (const uint8_t[]){0x00, 0x03}, 2);
+    check_key_prefix(0, 63, (const uint8_t[]){0x00, 0x7e}, 2);
+    check_key_prefix(0, -64, (const uint8_t[]){0x00, 0x7f}, 2);
+    check_key_prefix(0, 64, (const uint8_t[]){0x00, 0x80, 0x01}, 3);
+    check_key_prefix(0, INT32_MAX, (const uint8_t[]){0x00, 0xfe, 0xff, 0xff, 0xff, 0x0f}, 6);
+    check_key_prefix(0, INT32_MIN, (const uint8_t[]){0x00, 0xff, 0xff, 0xff, 0xff, 0x0f}, 6);
+}
+
+ZTEST(codec, test_key) {
+    const struct codec_state state = {
+        .last = entry(300, -7200, 1234, 766, -2150, 2950),
+        .interval = 600,
+    };
+    uint8_t buf[CODEC_MAX_LEN];
+    struct codec_state decoded;
+
+    const size_t len = codec_encode_key(&state, buf, sizeof(buf));
+    zassert_true(len > 0);
+    zassert_equal(codec_decode_key(&decoded, buf, len), len);
+    assert_entry(&decoded.last, &state.last);
+    zassert_equal(decoded.interval, state.interval);
+}
+
+ZTEST(codec, test_max_len) {
+    const struct codec_state state = {
+        .last = entry(UINT32_MAX, INT32_MIN, UINT16_MAX, UINT16_MAX, INT16_MIN, UINT16_MAX),
+        .interval = INT32_MIN,
+    };
+    uint8_t buf[CODEC_MAX_LEN];
+
+    zassert_equal(codec_encode_key(&state, buf, sizeof(buf)), CODEC_MAX_LEN);
+
+    // Largest possible change of every field
+    struct codec_state s = {.last = entry(0, 0, 0, UINT16_MAX, INT16_MIN, 0), .interval = 0};
+    const struct history_entry e = entry(UINT32_MAX, INT32_MIN, UINT16_MAX, 0, INT16_MAX, 0);
+    const size_t len = codec_encode(&s, &e, buf, sizeof(buf));
+    zassert_true(len > 0 && len <= CODEC_MAX_LEN, "len = %zu", len);
+}
+
+ZTEST(codec, test_delta_of_delta) {
+    const struct history_entry entries[] = {
+        entry(10, 600, 1000, 1000, 2000, 3000),
+        entry(11, 1200, 1001, 999, 2001, 3000),
+        entry(12, 1800, 1003, 997, 2003, 2999),
+        entry(13, 2400, 1004, 996, 2010, 2999),
+    };
+    struct codec_state enc = {.last = entries[0]};
+    uint8_t buf[ARRAY_SIZE(entries) * CODEC_MAX_LEN];
+    size_t pos = codec_encode_key(&enc, buf, sizeof(buf));
+    size_t lens[ARRAY_SIZE(entries)] = {pos};
+
+    for (size_t i = 1; i < ARRAY_SIZE(entries); ++i) {
+        lens[i] = codec_encode(&enc, &entries[i], &buf[pos], sizeof(buf) - pos);
+        pos += lens[i];
+    }
+    // The first entry changes the interval from 0 to 600, after which a
+    // regular period and small changes take a byte per field
+    zassert_equal(lens[1], 7);
+    zassert_equal(lens[2], 6);
+    zassert_equal(lens[3], 6);
+
+    struct codec_state dec;
+    size_t read = codec_decode_key(&dec, buf, pos);
+    zassert_equal(read, lens[0]);
+    assert_entry(&dec.last, &entries[0]);
+    for (size_t i = 1; i < ARRAY_SIZE(entries); ++i) {
+        const size_t len = codec_decode(&dec, &buf[read], pos - read);
+        zassert_equal(len, lens[i], "entry %zu", i);
+        assert_entry(&dec.last, &entries[i]);
+        read += len;
+    }
+    zassert_equal(dec.interval, 600);
+}
+
+ZTEST(codec, test_negative_deltas) {
+    const struct history_entry entries[] = {
+        // Restored from flash, so the time is before boot
+        entry(100, -3000, 2000, 500, 150, 3000),
+        // Skipped sequence numbers and a shorter interval
+        entry(105, -2900, 1500, 1000, -50, 2800),
+        entry(106, -2850, 0, 2500, -2000, 2100),
+        // Time crosses zero and the interval grows again
+        entry(107, 600, UINT16_MAX, 0, INT16_MAX, 0),
+        entry(108, 500, 0, UINT16_MAX, INT16_MIN, UINT16_MAX),
+    };
+    struct codec_state enc = {.last = entries[0]};
+    struct codec_state dec = enc;
+    uint8_t buf[CODEC_MAX_LEN];
+
+    for (size_t i = 1; i < ARRAY_SIZE(entries); ++i) {
+        const size_t len = codec_encode(&enc, &entries[i], buf, sizeof(buf));
+        zassert_true(len > 0, "entry %zu", i);
+        zassert_equal(codec_decode(&dec, buf, len), len, "entry %zu", i);
+        assert_entry(&dec.last, &entries[i]);
+    }
+    zassert_equal(dec.interval, -100);
+}
+
+ZTEST(codec, test_encode_short_buffer) {
+    const struct codec_state key = {.last = entry(300, 7200, 1234, 766, 2150, 2950)};
+    const struct history_entry e = entry(301, 7800, 1300, 700, 2100, 2940);
+    uint8_t buf[CODEC_MAX_LEN];
+
+    const size_t key_len = codec_encode_key(&key, buf, sizeof(buf));
+    for (size_t len = 0; len < key_len; ++len) {
+        zassert_equal(codec_encode_key(&key, buf, len), 0, "len = %zu", len);
+    }
+
+    struct codec_state s = key;
+    const size_t entry_len = codec_encode(&s, &e, buf, sizeof(buf));
+    for (size_t len = 0; len < entry_len; ++len) {
+        s = key;
+        zassert_equal(codec_encode(&s, &e, buf, len), 0, "len = %zu", len);
+        // Unchanged, so the entry can be encoded again into a new buffer
+        assert_entry(&s.last, &key.last);
+        zassert_equal(s.interval, key.interval);
+    }
+}
+
+ZTEST(codec, test_decode_truncated) {
+    const struct codec_state key = {.last = entry(300, 7200, 1234, 766, 2150, 2950)};
+    const struct history_entry e = entry(301, 7800, 1300, 700, 2100, 2940);
+    uint8_t key_buf[CODEC_MAX_LEN];
+    uint8_t buf[CODEC_MAX_LEN];
+    struct codec_state s = key;
+
+    const size_t key_len = codec_encode_key(&key, key_buf, sizeof(key_buf));
+    for (size_t len = 0; len < key_len; ++len) {
+        zassert_equal(codec_decode_key(&s, key_buf, len), 0, "len = %zu", len);
+    }
+
+    const size_t entry_len = codec_encode(&s, &e, buf, sizeof(buf));
+    for (size_t len = 0; len < entry_len; ++len) {
+        s = key;
+        zassert_equal(codec_decode(&s, buf, len), 0, "len = %zu", len);
+        assert_entry(&s.last, &key.last);
+    }
+}
+
+ZTEST(codec, test_decode_corrupt) {
+    // More continuation bytes than a 32-bit varint can have
+    const uint8_t buf[CODEC_MAX_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0x01};
+    const struct codec_state key = {.last = entry(1, 0, 1000, 1000, 2000, 3000)};
+    struct codec_state s = key;
+
+    zassert_equal(codec_decode_key(&s, buf, sizeof(buf)), 0);
+    zassert_equal(codec_decode(&s, buf, sizeof(buf)), 0);
+    assert_entry(&s.last, &key.last);
+}
+
+ZTEST_SUITE(codec, NULL, NULL, NULL, NULL, NULL);
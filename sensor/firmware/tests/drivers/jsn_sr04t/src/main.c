@@ -0,0 +1,296 @@
+#include <app/drivers/sensor/jsn_sr04t.h>
+#include <app/drivers/sensor/jsn_sr04t_emul.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/ztest.h>
+
+#include "sensor_stub.h"
+
+// Error allowed in a measured distance, mostly from the timer resolution
+#define TOLERANCE_MM 10
+// Longer than the emulator holds the echo high for a timeout, so the echo
+// line is idle again afterwards
+#define STUCK_ECHO_MS 70
+
+static const struct device* const rangefinder = DEVICE_DT_GET(DT_NODELABEL(rangefinder));
+static const struct emul* const rangefinder_emul = EMUL_DT_GET(DT_NODELABEL(rangefinder));
+static const struct device* const air_temperature = DEVICE_DT_GET(DT_ALIAS(air_temperature));
+
+// Emulator ping count at the start of the test
+static size_t first_ping;
+
+static size_t ping_count(void) {
+    return sr04t_emul_get_ping_count(rangefinder_emul) - first_ping;
+}
+
+static int fetch_mm(int32_t* distance_mm) {
+    struct sensor_value value;
+
+    int err = sensor_sample_fetch(rangefinder);
+    if (err < 0) return err;
+    zassert_ok(sensor_channel_get(rangefinder, SENSOR_CHAN_DISTANCE, &value));
+    *distance_mm = sensor_value_to_milli(&value);
+    return 0;
+}
+
+static void assert_distance(int32_t actual_mm, int32_t expected_mm) {
+    zassert_within(actual_mm, expected_mm, TOLERANCE_MM, "%d mm, expected %d mm", actual_mm,
+                   expected_mm);
+}
+
+static void set_range(uint32_t range_mm) {
+    struct sensor_value value;
+
+    sensor_value_from_milli(&value, range_mm);
+    zassert_ok(sensor_attr_set(rangefinder, SENSOR_CHAN_DISTANCE, SENSOR_ATTR_FULL_SCALE, &value));
+}
+
+/**
+ * Run a burst and wait for it to finish.
+ *
+ * @return number of pings sent, or a negative error code
+ */
+static int run_burst(uint32_t* echo_ns, size_t count, k_timeout_t spacing, k_timeout_t timeout) {
+    const struct sr04t_burst burst = {
+        .echo_ns = echo_ns,
+        .count = count,
+        .spacing = spacing,
+        .timeout = timeout,
+    };
+    struct k_poll_signal signal;
+    struct k_poll_event event =
+        K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &signal);
+    unsigned int signaled;
+    int result;
+
+    k_poll_signal_init(&signal);
+    zassert_ok(sr04t_burst_start(rangefinder, &burst, &signal));
+    // Only one measurement at a time
+    zassert_equal(sr04t_burst_start(rangefinder, &burst, &signal), -EBUSY);
+    zassert_equal(sensor_sample_fetch(rangefinder), -EBUSY);
+
+    zassert_ok(k_poll(&event, 1, K_SECONDS(5)));
+    k_poll_signal_check(&signal, &signaled, &result);
+    zassert_true(signaled);
+    return result;
+}
+
+ZTEST(jsn_sr04t, test_echo) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_ECHO, 1000},
+        {SR04T_EMUL_ECHO, 250},
+        {SR04T_EMUL_ECHO, 1800},
+    };
+    int32_t distance_mm;
+
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), false);
+    for (size_t i = 0; i < ARRAY_SIZE(script); ++i) {
+        zassert_ok(fetch_mm(&distance_mm));
+        assert_distance(distance_mm, script[i].distance_mm);
+    }
+    zassert_equal(ping_count(), ARRAY_SIZE(script));
+
+    // Script ran out, so every further ping is a dropout
+    zassert_equal(fetch_mm(&distance_mm), -ETIMEDOUT);
+}
+
+ZTEST(jsn_sr04t, test_repeat) {
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_ECHO, 800}};
+    int32_t distance_mm;
+
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), true);
+    for (size_t i = 0; i < 3; ++i) {
+        zassert_ok(fetch_mm(&distance_mm));
+        assert_distance(distance_mm, 800);
+    }
+}
+
+ZTEST(jsn_sr04t, test_dropout) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_DROPOUT},
+        {SR04T_EMUL_ECHO, 1500},
+    };
+    int32_t distance_mm;
+
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), false);
+    zassert_equal(fetch_mm(&distance_mm), -ETIMEDOUT);
+    zassert_ok(fetch_mm(&distance_mm));
+    assert_distance(distance_mm, 1500);
+}
+
+ZTEST(jsn_sr04t, test_timeout) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_TIMEOUT},
+        {SR04T_EMUL_ECHO, 1000},
+    };
+    int32_t distance_mm;
+
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), false);
+    zassert_equal(fetch_mm(&distance_mm), -ETIMEDOUT);
+
+    // The echo is still high, so the driver must not ping again
+    zassert_equal(fetch_mm(&distance_mm), -EBUSY);
+    zassert_equal(ping_count(), 1);
+
+    k_msleep(STUCK_ECHO_MS);
+    zassert_ok(fetch_mm(&distance_mm));
+    assert_distance(distance_mm, 1000);
+}
+
+ZTEST(jsn_sr04t, test_max_range) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_ECHO, 3000},
+        {SR04T_EMUL_ECHO, 900},
+    };
+    int32_t distance_mm;
+
+    // The echo timeout follows the range, so echoes from further away are
+    // not waited for
+    set_range(1000);
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), false);
+    zassert_equal(fetch_mm(&distance_mm), -ETIMEDOUT);
+
+    k_msleep(STUCK_ECHO_MS);
+    zassert_ok(fetch_mm(&distance_mm));
+    assert_distance(distance_mm, 900);
+}
+
+ZTEST(jsn_sr04t, test_burst) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_ECHO, 500},
+        {SR04T_EMUL_DROPOUT},
+        {SR04T_EMUL_ECHO, 1500},
+        {SR04T_EMUL_TIMEOUT},
+        {SR04T_EMUL_ECHO, 2000},
+    };
+    uint32_t echo_ns[ARRAY_SIZE(script)];
+
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), false);
+    // Spaced so the echo line is idle again after the timeout
+    const int sent =
+        run_burst(echo_ns, ARRAY_SIZE(echo_ns), K_MSEC(STUCK_ECHO_MS), K_SECONDS(2));
+
+    zassert_equal(sent, ARRAY_SIZE(script));
+    zassert_equal(ping_count(), ARRAY_SIZE(script));
+    for (size_t i = 0; i < ARRAY_SIZE(script); ++i) {
+        if (script[i].type == SR04T_EMUL_ECHO) {
+            assert_distance(sr04t_echo_to_mm(rangefinder, echo_ns[i]), script[i].distance_mm);
+        } else {
+            zassert_equal(echo_ns[i], 0, "ping %zu", i);
+        }
+    }
+}
+
+ZTEST(jsn_sr04t, test_burst_deadline) {
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_ECHO, 1000}};
+    uint32_t echo_ns[8];
+
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), true);
+    const int sent = run_burst(echo_ns, ARRAY_SIZE(echo_ns), K_MSEC(50), K_MSEC(120));
+
+    // Pings that did not fit before the deadline are neither sent nor counted
+    const size_t pings = ping_count();
+    zassert_true(pings >= 2 && pings < ARRAY_SIZE(echo_ns), "%zu pings", pings);
+    zassert_equal(sent, pings);
+    for (size_t i = 0; i < ARRAY_SIZE(echo_ns); ++i) {
+        if (i < pings) {
+            assert_distance(sr04t_echo_to_mm(rangefinder, echo_ns[i]), 1000);
+        } else {
+            zassert_equal(echo_ns[i], 0, "ping %zu", i);
+        }
+    }
+}
+
+ZTEST(jsn_sr04t, test_burst_cancel) {
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_ECHO, 1000}};
+    uint32_t echo_ns[8];
+    const struct sr04t_burst burst = {
+        .echo_ns = echo_ns,
+        .count = ARRAY_SIZE(echo_ns),
+        .spacing = K_MSEC(50),
+        .timeout = K_SECONDS(2),
+    };
+    struct k_poll_signal signal;
+    unsigned int signaled;
+    int result;
+    int32_t distance_mm;
+
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), true);
+    k_poll_signal_init(&signal);
+    zassert_ok(sr04t_burst_start(rangefinder, &burst, &signal));
+    k_msleep(120);
+    zassert_ok(sr04t_burst_cancel(rangefinder));
+    zassert_equal(sr04t_burst_cancel(rangefinder), -EALREADY);
+
+    // No more pings, and the signal is never raised
+    const size_t pings = ping_count();
+    zassert_true(pings >= 1 && pings < ARRAY_SIZE(echo_ns), "%zu pings", pings);
+    k_msleep(200);
+    zassert_equal(ping_count(), pings);
+    k_poll_signal_check(&signal, &signaled, &result);
+    zassert_false(signaled);
+
+    // Free for other measurements
+    zassert_ok(fetch_mm(&distance_mm));
+    assert_distance(distance_mm, 1000);
+}
+
+ZTEST(jsn_sr04t, test_temperature_compensation) {
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_ECHO, 1000}};
+    const struct sensor_value freezing = {.val1 = 0};
+    struct sensor_value temperature;
+    int32_t distance_mm;
+
+    Z_TEST_SKIP_IFNDEF(CONFIG_JSN_SR04T_TEMP_COMPENSATION);
+
+    // Same path as the firmware: read the air temperature and pass it on
+    sensor_stub_set(air_temperature, &freezing);
+    zassert_ok(sensor_sample_fetch(air_temperature));
+    zassert_ok(sensor_channel_get(air_temperature, SENSOR_CHAN_AMBIENT_TEMP, &temperature));
+    zassert_ok(sensor_attr_set(rangefinder,
+                               SENSOR_CHAN_AMBIENT_TEMP,
+                               (enum sensor_attribute)SENSOR_ATTR_SR04T_AIR_TEMPERATURE,
+                               &temperature));
+
+    // The emulator answers for 20 C, so the echo comes back later than the
+    // driver expects at 0 C: 1000 mm * 331.3 / 343.4
+    sr04t_emul_set_script(rangefinder_emul, script, ARRAY_SIZE(script), false);
+    zassert_ok(fetch_mm(&distance_mm));
+    assert_distance(distance_mm, 965);
+}
+
+static void* jsn_sr04t_setup(void) {
+    zassert_true(device_is_ready(rangefinder));
+    zassert_true(device_is_ready(air_temperature));
+    return NULL;
+}
+
+static void jsn_sr04t_before(void* fixture) {
+    ARG_UNUSED(fixture);
+
+    sr04t_emul_set_script(rangefinder_emul, NULL, 0, false);
+    first_ping = sr04t_emul_get_ping_count(rangefinder_emul);
+    zassert_ok(pm_device_runtime_get(rangefinder));
+    set_range(0);
+#ifdef CONFIG_JSN_SR04T_TEMP_COMPENSATION
+    const struct sensor_value room = {.val1 = 20};
+    zassert_ok(sensor_attr_set(rangefinder,
+                               SENSOR_CHAN_AMBIENT_TEMP,
+                               (enum sensor_attribute)SENSOR_ATTR_SR04T_AIR_TEMPERATURE,
+                               &room));
+#endif
+}
+
+static void jsn_sr04t_after(void* fixture) {
+    ARG_UNUSED(fixture);
+
+    zassert_ok(pm_device_runtime_put(rangefinder));
+    // Let any echo still in progress finish before the next test
+    k_msleep(STUCK_ECHO_MS);
+}
+
+ZTEST_SUITE(jsn_sr04t, NULL, jsn_sr04t_setup, jsn_sr04t_before, jsn_sr04t_after, NULL);
@@ -0,0 +1,54 @@
+/*
+ * Stub sensor for devices that have no driver on native_sim. Fetching always
+ * succeeds, and every channel reads the value set with sensor_stub_set().
+ */
+
+#define DT_DRV_COMPAT test_sensor_stub
+
+#include "sensor_stub.h"
+
+struct sensor_stub_data {
+    struct sensor_value value;
+};
+
+void sensor_stub_set(const struct device* dev, const struct sensor_value* val) {
+    struct sensor_stub_data* data = dev->data;
+
+    data->value = *val;
+}
+
+static int sensor_stub_sample_fetch(const struct device* dev, enum sensor_channel chan) {
+    ARG_UNUSED(dev);
+    ARG_UNUSED(chan);
+
+    return 0;
+}
+
+static int sensor_stub_channel_get(const struct device* dev, enum sensor_channel chan,
+                                   struct sensor_value* val) {
+    const struct sensor_stub_data* data = dev->data;
+
+    ARG_UNUSED(chan);
+
+    *val = data->value;
+    return 0;
+}
+
+static const struct sensor_driver_api sensor_stub_api = {
+    .sample_fetch = &sensor_stub_sample_fetch,
+    .channel_get = &sensor_stub_channel_get,
+};
+
+#define SENSOR_STUB_INST(inst)                                \
+    static struct sensor_stub_data sensor_stub_data_##inst;   \
+                                                              \
+    SENSOR_DEVICE_DT_INST_DEFINE(inst,                        \
+                                 NULL,                        \
+                                 NULL,                        \
+                                 &sensor_stub_data_##inst,    \
+                                 NULL,                        \
+                                 POST_KERNEL,                 \
+                                 CONFIG_SENSOR_INIT_PRIORITY, \
+                                 &sensor_stub_api);
+
+DT_INST_FOREACH_STATUS_OKAY(SENSOR_STUB_INST)
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+
+/**
+ * Set the value returned by a stub sensor on every channel.
+ */
+void sensor_stub_set(const struct device* dev, const struct sensor_value* val);
@@ -0,0 +1,189 @@
+#include <zephyr/sys/util.h>
+#include <zephyr/ztest.h>
+
+#include "filter.h"
+
+#define MAX_VALUES 16
+
+static void sort(uint32_t* values, size_t count) {
+    for (size_t i = 1; i < count; ++i) {
+        const uint32_t v = values[i];
+        size_t j = i;
+        for (; j > 0 && values[j - 1] > v; --j) {
+            values[j] = values[j - 1];
+        }
+        values[j] = v;
+    }
+}
+
+/**
+ * Check filter_select() for every k against a sorted copy, including the
+ * partition it leaves behind.
+ */
+static void check_select(const uint32_t* input, size_t count) {
+    uint32_t sorted[MAX_VALUES];
+    memcpy(sorted, input, count * sizeof(*input));
+    sort(sorted, count);
+
+    for (size_t k = 0; k < count; ++k) {
+        uint32_t values[MAX_VALUES];
+        memcpy(values, input, count * sizeof(*input));
+
+        zassert_equal(filter_select(values, count, k), sorted[k], "k = %zu", k);
+        zassert_equal(values[k], sorted[k], "k = %zu", k);
+        for (size_t i = 0; i < k; ++i) {
+            zassert_true(values[i] <= values[k], "k = %zu, i = %zu", k, i);
+        }
+        for (size_t i = k + 1; i < count; ++i) {
+            zassert_true(values[i] >= values[k], "k = %zu, i = %zu", k, i);
+        }
+    }
+}
+
+static uint32_t median(const uint32_t* input, size_t count) {
+    uint32_t values[MAX_VALUES];
+    memcpy(values, input, count * sizeof(*input));
+    return filter_median(values, count);
+}
+
+static uint32_t trimmed_mean(const uint32_t* input, size_t count, size_t trim) {
+    uint32_t values[MAX_VALUES];
+    memcpy(values, input, count * sizeof(*input));
+    return filter_trimmed_mean(values, count, trim);
+}
+
+static uint32_t mad_mean(const uint32_t* input, size_t count, uint32_t threshold_tenths) {
+    uint32_t values[MAX_VALUES];
+    uint32_t scratch[MAX_VALUES];
+    memcpy(values, input, count * sizeof(*input));
+    return filter_mad_mean(values, scratch, count, threshold_tenths);
+}
+
+ZTEST(filter, test_select_single) {
+    const uint32_t values[] = {42};
+    check_select(values, ARRAY_SIZE(values));
+}
+
+ZTEST(filter, test_select_odd) {
+    const uint32_t values[] = {1520, 1498, 3100, 1501, 1499, 1500, 12};
+    check_select(values, ARRAY_SIZE(values));
+}
+
+ZTEST(filter, test_select_even) {
+    const uint32_t values[] = {9, 3, 7, 1, 8, 2, 6, 4, 5, 0};
+    check_select(values, ARRAY_SIZE(values));
+}
+
+ZTEST(filter, test_select_sorted) {
+    const uint32_t ascending[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    const uint32_t descending[] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+    check_select(ascending, ARRAY_SIZE(ascending));
+    check_select(descending, ARRAY_SIZE(descending));
+}
+
+ZTEST(filter, test_select_duplicates) {
+    const uint32_t all_equal[] = {700, 700, 700, 700, 700, 700, 700, 700, 700};
+    const uint32_t duplicates[] = {5, 1, 5, 3, 1, 5, 3, 3, 1, 5, 0, UINT32_MAX, 0, UINT32_MAX};
+    check_select(all_equal, ARRAY_SIZE(all_equal));
+    check_select(duplicates, ARRAY_SIZE(duplicates));
+}
+
+ZTEST(filter, test_median) {
+    const uint32_t single[] = {1234};
+    zassert_equal(median(single, ARRAY_SIZE(single)), 1234);
+
+    const uint32_t odd[] = {5, 1, 3};
+    zassert_equal(median(odd, ARRAY_SIZE(odd)), 3);
+
+    // Average of the middle two, rounded half up
+    const uint32_t even[] = {4, 1, 3, 2};
+    zassert_equal(median(even, ARRAY_SIZE(even)), 3);
+    const uint32_t even_exact[] = {10, 40, 20, 30, 0, 50};
+    zassert_equal(median(even_exact, ARRAY_SIZE(even_exact)), 25);
+
+    // No overflow when averaging large values
+    const uint32_t large[] = {UINT32_MAX, UINT32_MAX - 2};
+    zassert_equal(median(large, ARRAY_SIZE(large)), UINT32_MAX - 1);
+}
+
+ZTEST(filter, test_median_duplicates) {
+    const uint32_t all_equal[] = {800, 800, 800, 800};
+    zassert_equal(median(all_equal, ARRAY_SIZE(all_equal)), 800);
+
+    const uint32_t duplicates[] = {2, 2, 1, 2, 9};
+    zassert_equal(median(duplicates, ARRAY_SIZE(duplicates)), 2);
+}
+
+ZTEST(filter, test_median_outliers) {
+    // Multipath echoes only ever make the distance longer
+    const uint32_t values[] = {1500, 1502, 3010, 1499, 3005, 1501, 4520};
+    zassert_equal(median(values, ARRAY_SIZE(values)), 1502);
+}
+
+ZTEST(filter, test_trimmed_mean) {
+    const uint32_t single[] = {321};
+    zassert_equal(trimmed_mean(single, ARRAY_SIZE(single), 0), 321);
+
+    const uint32_t untrimmed[] = {1, 2, 3, 4};
+    zassert_equal(trimmed_mean(untrimmed, ARRAY_SIZE(untrimmed), 0), 3);
+
+    const uint32_t odd[] = {13, 10, 1000, 12, 11};
+    zassert_equal(trimmed_mean(odd, ARRAY_SIZE(odd), 1), 12);
+
+    const uint32_t even[] = {1, 100, 3, 2};
+    zassert_equal(trimmed_mean(even, ARRAY_SIZE(even), 1), 3);
+
+    // Trimming down to a single value is the median
+    const uint32_t to_one[] = {7, 1, 9, 3, 5};
+    zassert_equal(trimmed_mean(to_one, ARRAY_SIZE(to_one), 2), 5);
+}
+
+ZTEST(filter, test_trimmed_mean_duplicates) {
+    const uint32_t all_equal[] = {600, 600, 600, 600, 600, 600};
+    zassert_equal(trimmed_mean(all_equal, ARRAY_SIZE(all_equal), 2), 600);
+
+    // Exactly trim values are dropped from each end, even when they have
+    // duplicates: 1, 50, 50 and 50 remain
+    const uint32_t duplicates[] = {100, 1, 1, 1, 100, 50, 50, 50};
+    zassert_equal(trimmed_mean(duplicates, ARRAY_SIZE(duplicates), 2), 38);
+}
+
+ZTEST(filter, test_trimmed_mean_outliers) {
+    // Two outliers on the long side are trimmed along with two good samples
+    const uint32_t values[] = {10, 11, 12, 900, 1000, 12, 11};
+    zassert_equal(trimmed_mean(values, ARRAY_SIZE(values), 2), 12);
+}
+
+ZTEST(filter, test_mad_mean) {
+    const uint32_t single[] = {77};
+    zassert_equal(mad_mean(single, ARRAY_SIZE(single), 30), 77);
+
+    // Median 102, MAD 1, so everything within 3 of the median is kept
+    const uint32_t odd[] = {100, 101, 102, 103, 5000};
+    zassert_equal(mad_mean(odd, ARRAY_SIZE(odd), 30), 102);
+
+    // Median 2, MAD 1, every value is exactly 1 MAD away
+    const uint32_t even[] = {1, 3, 1, 3};
+    zassert_equal(mad_mean(even, ARRAY_SIZE(even), 10), 2);
+}
+
+ZTEST(filter, test_mad_mean_duplicates) {
+    // MAD of 0 keeps exactly the values equal to the median
+    const uint32_t all_equal[] = {1500, 1500, 1500, 1500, 1500};
+    zassert_equal(mad_mean(all_equal, ARRAY_SIZE(all_equal), 30), 1500);
+
+    const uint32_t duplicates[] = {1500, 1500, 1500, 1510, 1500, 1490};
+    zassert_equal(mad_mean(duplicates, ARRAY_SIZE(duplicates), 30), 1500);
+
+    // With nothing within the limit, fall back to the median
+    const uint32_t split[] = {1, 3};
+    zassert_equal(mad_mean(split, ARRAY_SIZE(split), 0), 2);
+}
+
+ZTEST(filter, test_mad_mean_outliers) {
+    // Several multipath echoes on the long side, median 101, MAD 1
+    const uint32_t values[] = {100, 100, 101, 102, 2000, 2100, 99};
+    zassert_equal(mad_mean(values, ARRAY_SIZE(values), 30), 100);
+}
+
+ZTEST_SUITE(filter, NULL, NULL, NULL, NULL, NULL);
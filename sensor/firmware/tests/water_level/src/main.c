@@ -0,0 +1,165 @@
+#include <app/drivers/sensor/jsn_sr04t_emul.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/ztest.h>
+
+#include "bluetooth.h"
+#include "stubs.h"
+#include "water_level.h"
+
+// Error allowed in a measured distance, mostly from the timer resolution
+#define TOLERANCE_MM 10
+#define TANK_DEPTH_MM 2000
+#define DISTANCE_MM 800
+
+#ifdef CONFIG_WATER_LEVEL_ADAPTIVE_SAMPLING
+// Agreeing samples stop the measurement early
+#define EXPECTED_SAMPLES CONFIG_WATER_LEVEL_MIN_SAMPLES
+#else
+#define EXPECTED_SAMPLES CONFIG_WATER_LEVEL_SAMPLES
+#endif
+
+static const struct emul* const rangefinder_emul = EMUL_DT_GET(DT_NODELABEL(rangefinder));
+
+/**
+ * Run a complete measurement against a scripted rangefinder.
+ */
+static void measure(const struct sr04t_emul_ping* script, size_t count, bool repeat) {
+    sr04t_emul_set_script(rangefinder_emul, script, count, repeat);
+
+    const size_t first_ping = sr04t_emul_get_ping_count(rangefinder_emul);
+    const int64_t start = k_uptime_get();
+    zassert_ok(water_level_power_on());
+    zassert_ok(water_level_update());
+    const int64_t duration = k_uptime_get() - start;
+
+    // The measurement reports the pings it triggered
+    zassert_equal(water_level_get_pings(),
+                  sr04t_emul_get_ping_count(rangefinder_emul) - first_ping);
+    TC_PRINT("%u pings, %u samples, %lld ms\n",
+             water_level_get_pings(),
+             water_level_get_samples(),
+             duration);
+}
+
+static void assert_level(void) {
+    zassert_within(water_level_get(),
+                   TANK_DEPTH_MM - DISTANCE_MM,
+                   TOLERANCE_MM,
+                   "level %u mm",
+                   water_level_get());
+}
+
+ZTEST(water_level, test_echoes) {
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_ECHO, DISTANCE_MM}};
+
+    measure(script, ARRAY_SIZE(script), true);
+
+    assert_level();
+    zassert_equal(water_level_get_samples(), EXPECTED_SAMPLES);
+    zassert_equal(water_level_get_pings(), EXPECTED_SAMPLES);
+    zassert_false(bluetooth_get_error(ERROR_WATER_LEVEL));
+}
+
+ZTEST(water_level, test_alternating_dropouts) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+        {SR04T_EMUL_DROPOUT},
+    };
+
+    measure(script, ARRAY_SIZE(script), true);
+
+    // Failed pings are retried within the attempt limit
+    assert_level();
+    zassert_equal(water_level_get_samples(), EXPECTED_SAMPLES);
+    zassert_true(water_level_get_pings() >= 2 * EXPECTED_SAMPLES - 1);
+    zassert_false(bluetooth_get_error(ERROR_WATER_LEVEL));
+}
+
+ZTEST(water_level, test_occasional_timeouts) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+        {SR04T_EMUL_TIMEOUT},
+    };
+
+    measure(script, ARRAY_SIZE(script), true);
+
+    // Timeouts are retried like dropouts
+    assert_level();
+    zassert_equal(water_level_get_samples(), EXPECTED_SAMPLES);
+    zassert_false(bluetooth_get_error(ERROR_WATER_LEVEL));
+}
+
+ZTEST(water_level, test_all_dropouts) {
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_DROPOUT}};
+
+    measure(script, ARRAY_SIZE(script), true);
+
+    // Every attempt is used, and the last level is kept
+    assert_level();
+    zassert_equal(water_level_get_samples(), 0);
+    zassert_equal(water_level_get_pings(), CONFIG_WATER_LEVEL_MAX_ATTEMPTS);
+    zassert_true(bluetooth_get_error(ERROR_WATER_LEVEL));
+}
+
+ZTEST(water_level, test_all_timeouts) {
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_TIMEOUT}};
+
+    measure(script, ARRAY_SIZE(script), true);
+
+    assert_level();
+    zassert_equal(water_level_get_samples(), 0);
+    zassert_true(bluetooth_get_error(ERROR_WATER_LEVEL));
+}
+
+ZTEST(water_level, test_few_echoes) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+    };
+
+    // Dropouts once the script runs out
+    measure(script, ARRAY_SIZE(script), false);
+
+    // The level is still updated from the samples there are
+    assert_level();
+    zassert_equal(water_level_get_samples(), ARRAY_SIZE(script));
+    zassert_true(bluetooth_get_error(ERROR_WATER_LEVEL));
+}
+
+ZTEST(water_level, test_converged) {
+    static const struct sr04t_emul_ping script[] = {
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+        {SR04T_EMUL_ECHO, DISTANCE_MM},
+    };
+
+    measure(script, ARRAY_SIZE(script), false);
+
+    // Enough agreeing samples are only an error when all samples are required
+    assert_level();
+    zassert_equal(water_level_get_samples(), ARRAY_SIZE(script));
+    zassert_equal(bluetooth_get_error(ERROR_WATER_LEVEL),
+                  !IS_ENABLED(CONFIG_WATER_LEVEL_ADAPTIVE_SAMPLING));
+}
+
+static void* water_level_setup(void) {
+    zassert_ok(water_level_init());
+    water_level_set_tank_depth(TANK_DEPTH_MM);
+
+    // Every test starts from a known level, so failed measurements can be
+    // checked to keep it
+    static const struct sr04t_emul_ping script[] = {{SR04T_EMUL_ECHO, DISTANCE_MM}};
+    measure(script, ARRAY_SIZE(script), true);
+    assert_level();
+    return NULL;
+}
+
+static void water_level_before(void* fixture) {
+    ARG_UNUSED(fixture);
+    stub_clear_errors();
+}
+
+ZTEST_SUITE(water_level, NULL, water_level_setup, water_level_before, NULL, NULL);
@@ -0,0 +1,42 @@
+/*
+ * Stand-ins for the modules water_level.c reports to. The Bluetooth stubs
+ * latch errors like bluetooth.c does, the rest do nothing.
+ */
+
+#include <zephyr/sys/atomic.h>
+
+#include "bluetooth.h"
+#include "energy.h"
+#include "persist.h"
+#include "power.h"
+#include "stubs.h"
+#include "trend.h"
+
+static atomic_t errors = ATOMIC_INIT(0);
+
+void stub_clear_errors(void) { atomic_clear(&errors); }
+
+void bluetooth_set_error(enum system_error e) { atomic_or(&errors, e); }
+
+bool bluetooth_get_error(enum system_error e) { return (atomic_get(&errors) & e) != 0; }
+
+void bluetooth_set_status(enum system_status s, bool value) {}
+
+void bluetooth_alert(void) {}
+
+void energy_add_time(enum energy_state state, uint32_t ms) {}
+
+void energy_add_events(enum energy_event event, uint32_t count) {}
+
+int persist_save(const char* key, const void* value, size_t len) { return 0; }
+
+const struct power_policy* power_get_policy(void) {
+    static const struct power_policy policy = {
+        .max_samples = UINT8_MAX,
+        .period_factor = 1,
+        .measure = true,
+    };
+    return &policy;
+}
+
+void trend_add(uint16_t level) {}
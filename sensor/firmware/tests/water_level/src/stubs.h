@@ -0,0 +1,6 @@
+#pragma once
+
+/**
+ * Clear the error bits latched by bluetooth_set_error().
+ */
+void stub_clear_errors(void);